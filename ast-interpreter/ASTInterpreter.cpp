@@ -6,161 +6,410 @@
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/Support/CommandLine.h"
 
 using namespace clang;
 
 #include "Environment.h"
+#include "Bytecode.h"
+#include "VM.h"
+#include "Stackless.h"
+#include "Jit.h"
+#include "Trace.h"
+#include "Baseline.h"
+#include "Specialize.h"
+#include "SsaInterpreter.h"
+#include "Closure.h"
+#include "ProgramImage.h"
+#include "Memo.h"
 
+enum EngineKind {
+   TreeWalker,
+   BytecodeVM,
+   ContinuationStack,
+   BaselineNative,
+   AheadOfTime,
+   SsaIR,
+   ClosureTree
+};
+
+static llvm::cl::opt<EngineKind> Engine("engine",
+		llvm::cl::desc("Execution engine"),
+		llvm::cl::values(
+			clEnumValN(TreeWalker, "tree", "walk the Clang AST (default)"),
+			clEnumValN(BytecodeVM, "vm", "lower to register bytecode and run it on the VM"),
+			clEnumValN(ContinuationStack, "stackless", "walk the Clang AST from an explicit continuation stack"),
+			clEnumValN(BaselineNative, "baseline", "copy-and-patch the bytecode into x86-64 code and run it"),
+			clEnumValN(AheadOfTime, "aot", "specialize the program to C++, compile it with the system compiler and cache it"),
+			clEnumValN(SsaIR, "ir", "run the SSA IR of Clang CodeGen on a pre-decoded interpreter"),
+			clEnumValN(ClosureTree, "closure", "convert every function body into pre-bound closures and run them")),
+		llvm::cl::init(TreeWalker));
+
+static llvm::cl::opt<unsigned> StackBudget("stack-budget",
+		llvm::cl::desc("MiB reserved for guest frames, operands and continuations"),
+		llvm::cl::init(256));
+
+static llvm::cl::opt<unsigned> JitThreshold("jit-threshold",
+		llvm::cl::desc("Calls plus loop iterations after which the tree walker compiles a function with ORC (0 disables the JIT)"),
+		llvm::cl::init(1000));
+
+static llvm::cl::opt<unsigned> TraceThreshold("trace-threshold",
+		llvm::cl::desc("Iterations after which the tree walker records and compiles a trace of a loop (0 disables tracing)"),
+		llvm::cl::init(100));
+
+static llvm::cl::opt<std::string> AotCache("aot-cache",
+		llvm::cl::desc("Directory of the programs compiled by --engine=aot (default: the user cache directory)"),
+		llvm::cl::init(""));
+
+static llvm::cl::opt<unsigned> MemoEntries("memo",
+		llvm::cl::desc("Entries of the result cache the tree walker keeps per pure function, hits and misses are reported at exit (0 disables memoization)"),
+		llvm::cl::init(0));
+
+static llvm::cl::opt<std::string> CompileImage("compile",
+		llvm::cl::desc("Write the bytecode of the program to <file> instead of running it"),
+		llvm::cl::value_desc("file"), llvm::cl::init(""));
+
+static llvm::cl::opt<std::string> RunImage("run",
+		llvm::cl::desc("Run the program image <file> written by --compile on the VM, without Clang"),
+		llvm::cl::value_desc("file"), llvm::cl::init(""));
+
+static llvm::cl::opt<std::string> Code(llvm::cl::Positional,
+		llvm::cl::desc("<source code>"));
+
+/// Evaluation is a single post-order pass over each statement:
+///  - visiting an Expr evaluates each of its evaluated children exactly once,
+///    left to right, then pops their values and pushes exactly one value of
+///    its own on the operand stack;
+///  - the left side of an assignment is an address: only its base/index or
+///    pointer operand is visited, never the lvalue itself;
+///  - a statement leaves the operand stack as it found it.
+/// Environment never evaluates a sub-expression on its own, it only consumes
+/// what the visitor left on the operand stack.
 class InterpreterVisitor : 
    public EvaluatedExprVisitor<InterpreterVisitor> {
 public:
    explicit InterpreterVisitor(const ASTContext &context, Environment * env)
-   : EvaluatedExprVisitor(context), mEnv(env) {}
+   : EvaluatedExprVisitor(context), mEnv(env), mJit(NULL), mTrace(NULL), mMemo(NULL), mFunction(0), mTailCall(NULL) {}
    virtual ~InterpreterVisitor() {}
 
+   /// Hand hot functions to jit; entry is the index of the function run first
+   void setJit(JitTier * jit, unsigned entry) {
+	   mJit = jit;
+	   mFunction = entry;
+   }
+   void setTrace(TraceTier * trace) {
+	   mTrace = trace;
+   }
+   void setMemo(MemoTable * memo) {
+	   mMemo = memo;
+   }
+
+   /// How a statement finished. Anything but Normal leaves the enclosing
+   /// statements directly, up to the loop or the function body it targets.
+   enum Completion {
+	   Normal,
+	   Break,
+	   Continue,
+	   Return,
+	   /// return of a tail call: its arguments are on the operand stack and
+	   /// the call is in mTailCall, for the caller's frame to be replaced
+	   TailCall
+   };
+
+   /// Run a statement, dropping the value an expression statement leaves.
+   /// Statements are dispatched here rather than through Visit, so that
+   /// their completion can be passed up; expressions contain no statements.
+   Completion execute(Stmt * stmt) {
+	   switch(stmt->getStmtClass()) {
+		   case Stmt::CompoundStmtClass:
+			   return executeCompound(cast<CompoundStmt>(stmt));
+		   case Stmt::IfStmtClass:
+			   return executeIf(cast<IfStmt>(stmt));
+		   case Stmt::WhileStmtClass:
+			   return executeWhile(cast<WhileStmt>(stmt));
+		   case Stmt::ForStmtClass:
+			   return executeFor(cast<ForStmt>(stmt));
+		   case Stmt::ReturnStmtClass:
+			   if(CallExpr * call = mEnv->getCalls().tailCall(cast<ReturnStmt>(stmt))) {
+				   for(Expr * arg : call->arguments())
+					   Visit(arg);
+				   mTailCall = call;
+				   return TailCall;
+			   }
+			   VisitStmt(stmt);
+			   mEnv->rstmt(cast<ReturnStmt>(stmt));
+			   return Return;
+		   case Stmt::BreakStmtClass:
+			   return Break;
+		   case Stmt::ContinueStmtClass:
+			   return Continue;
+		   default:
+			   break;
+	   }
+	   size_t depth = mEnv->getOperandDepth();
+	   Visit(stmt);
+	   if(isa<Expr>(stmt))
+		   mEnv->popOperand();
+	   assert(mEnv->getOperandDepth() == depth && "statement left operands behind");
+	   (void)depth;
+	   return Normal;
+   }
+   /// Evaluate an expression and take its value off the operand stack
+   int64_t evaluate(Expr * expr) {
+	   size_t depth = mEnv->getOperandDepth();
+	   Visit(expr);
+	   assert(mEnv->getOperandDepth() == depth + 1 && "expression must leave one value");
+	   (void)depth;
+	   return mEnv->popOperand();
+   }
+   /// Compute the operators invariant in loop into their frame slots. Their
+   /// operands are visited as usual, the operator itself bypasses its slot.
+   void hoist(Stmt * loop) {
+	   for(Expr * expr : mEnv->getNodes().hoistedBefore(loop)) {
+		   const NodeInfo & node = mEnv->getNodes().lookup(expr);
+		   VisitStmt(expr);
+		   if(BinaryOperator * bop = dyn_cast<BinaryOperator>(expr))
+			   mEnv->binop(bop, node);
+		   else
+			   mEnv->unaryop(cast<UnaryOperator>(expr));
+		   mEnv->bindSlot(node.slot, mEnv->popOperand());
+	   }
+   }
    virtual void VisitBinaryOperator (BinaryOperator * bop) {
-	   if(mEnv->getCurrentStack()->isRetState())
+	   const NodeInfo & node = mEnv->getNodes().lookup(bop);
+	   if(mEnv->folded(node) || mEnv->hoisted(node))
 		   return;
-	   VisitStmt(bop);
-	   mEnv->binop(bop);
+	   if(node.cursor) {
+		   Visit(bop->getRHS());
+		   mEnv->storeCursor(node);
+		   return;
+	   }
+	   if(bop->isAssignmentOp()) {
+		   // the left side is an address, only its components are evaluated
+		   Expr * left = bop->getLHS();
+		   if(auto ase = dyn_cast<ArraySubscriptExpr>(left)) {
+			   Visit(ase->getBase());
+			   Visit(ase->getIdx());
+		   } else if(auto uop = dyn_cast<UnaryOperator>(left)) {
+			   Visit(uop->getSubExpr());
+		   }
+		   Visit(bop->getRHS());
+	   } else
+		   VisitStmt(bop);
+	   mEnv->binop(bop, node);
    }
    virtual void VisitUnaryOperator(UnaryOperator * uop) {
-	   if(mEnv->getCurrentStack()->isRetState())
+	   const NodeInfo & node = mEnv->getNodes().lookup(uop);
+	   if(mEnv->folded(node) || mEnv->hoisted(node))
 		   return;
 	   VisitStmt(uop);
 	   mEnv->unaryop(uop);
    }
    virtual void VisitDeclRefExpr(DeclRefExpr * expr) {
-	   if(mEnv->getCurrentStack()->isRetState())
-		   return;
 	   VisitStmt(expr);
 	   mEnv->declref(expr);
    }
    virtual void VisitCastExpr(CastExpr * expr) {
-	   if(mEnv->getCurrentStack()->isRetState())
-		   return;
+	   // the value of the operand is also the value of the cast
 	   VisitStmt(expr);
-	   mEnv->cast(expr);
    }
    virtual void VisitCallExpr(CallExpr * call) {
-	   if(mEnv->getCurrentStack()->isRetState())
+	   for(Expr * arg : call->arguments())
+		   Visit(arg);
+	   const CallTarget & target = mEnv->getCalls().lookup(call);
+	   if(target.inlined) {
+		   // no frame, the returned expression reads the arguments in ours
+		   mEnv->call(call, target);
+		   Visit(target.inlined);
 		   return;
-	   VisitStmt(call);
-	   mEnv->call(call);
-	   FunctionDecl *fdecl = call->getDirectCallee();
-	   if(fdecl)
-	   {
-		   // call user-define func
-		   // TODO: handle global var
-		   if(!fdecl->getName().equals("GET") &&
-				!fdecl->getName().equals("PRINT") && 
-				!fdecl->getName().equals("MALLOC") &&
-				!fdecl->getName().equals("FREE"))
-		   {
-			   Visit(fdecl->getBody());
-			   bool hasret = false;
-			   int64_t retval = -1;
-			   if(mEnv->getCurrentStack()->hasRetVal())
-			   {
-				   hasret = true;
-				   retval = mEnv->getCurrentStack()->getRetVal();
-				   mEnv->popStack();
-				   mEnv->getCurrentStack()->bindStmt(call, retval);
-			   }
-			   else 
-				   mEnv->popStack();
-		   }
-
 	   }
-   }
-   virtual void VisitDeclStmt(DeclStmt * declstmt) {
-	   if(mEnv->getCurrentStack()->isRetState())
+	   if(mMemo && mMemo->pure(target)) {
+		   memoCall(call, target);
 		   return;
-	   VisitStmt(declstmt);
-	   mEnv->decl(declstmt);
+	   }
+	   if(target.kind == Call_User && mJit && mJit->invoke(target))
+		   return;
+	   mEnv->call(call, target);
+	   if(target.kind == Call_User)
+		   runCall(&target);
    }
-   virtual void VisitIfStmt(IfStmt * ifstmt) {
-	   // no mEnv->handle? setPC?
-	   if(mEnv->getCurrentStack()->isRetState())
+   /// A pure function called again with the same arguments takes its result
+   /// from the cache. Otherwise it is walked rather than handed to the JIT,
+   /// so that its own calls are memoized too.
+   void memoCall(CallExpr * call, const CallTarget & target) {
+	   int64_t args[MemoTable::MaxParams];
+	   int64_t result;
+	   std::copy_n(mEnv->topOperands(target.numParams), target.numParams, args);
+	   if(mMemo->find(target, args, result)) {
+		   mEnv->dropOperands(target.numParams);
+		   mEnv->pushOperand(result);
 		   return;
-	   Expr *condition = ifstmt->getCond();
-	   if(mEnv->getExpr(condition))
-	   {
-		   Visit(ifstmt->getThen());
 	   }
-	   else {
-		   if(ifstmt->getElse())
-		   {
-			   Visit(ifstmt->getElse());
+	   mEnv->call(call, target);
+	   runCall(&target);
+	   mMemo->insert(target, args, *mEnv->topOperands(1));
+   }
+   /// Run the user function whose frame call just pushed and leave its value
+   /// on the operand stack. Its tail calls pop the frame and push the one of
+   /// the callee in a loop here, without growing the host or guest stack.
+   void runCall(const CallTarget * target) {
+	   unsigned caller = mFunction;
+	   for(;;) {
+		   mFunction = target->index;
+		   if(execute(target->body) != TailCall)
+			   break;
+		   mEnv->popStack();
+		   target = &mEnv->getCalls().lookup(mTailCall);
+		   if(mJit && mJit->invoke(*target)) {
+			   mFunction = caller;
+			   return;
 		   }
+		   mEnv->call(mTailCall, *target);
 	   }
+	   mFunction = caller;
+	   int64_t retval = 0;
+	   if(mEnv->getCurrentStack()->hasRetVal())
+		   retval = mEnv->getCurrentStack()->getRetVal();
+	   mEnv->popStack();
+	   mEnv->pushOperand(retval);
    }
-   virtual void VisitWhileStmt(WhileStmt * wstmt) {
-	   // no mEnv->handle?
-	   if(mEnv->getCurrentStack()->isRetState())
-		   return;
+   Completion executeCompound(CompoundStmt * cstmt) {
+	   // local arrays of the block die with it, however it is left
+	   StackRegion & region = mEnv->getStackRegion();
+	   size_t mark = region.mark();
+	   Completion completion = Normal;
+	   for(Stmt * stmt : cstmt->body())
+		   if((completion = execute(stmt)) != Normal)
+			   break;
+	   region.release(mark);
+	   return completion;
+   }
+   virtual void VisitDeclStmt(DeclStmt * declstmt) {
+	   for(Decl * decl : declstmt->decls())
+		   if(VarDecl * vardecl = dyn_cast<VarDecl>(decl)) {
+			   if(mEnv->getNodes().lookup(vardecl).init)
+				   Visit(vardecl->getInit());
+			   mEnv->decl(vardecl);
+		   }
+   }
+   Completion executeIf(IfStmt * ifstmt) {
+	   Expr *condition = ifstmt->getCond();
+	   if(evaluate(condition))
+		   return execute(ifstmt->getThen());
+	   if(ifstmt->getElse())
+		   return execute(ifstmt->getElse());
+	   return Normal;
+   }
+   Completion executeWhile(WhileStmt * wstmt) {
 	   Expr* condition = wstmt->getCond();
-	   while(mEnv->getExpr(condition))
+	   hoist(wstmt);
+	   for(;;)
 	   {
-		   Visit(wstmt->getBody());
+		   if(mTrace) {
+			   LoopOutcome outcome = mTrace->enter(wstmt);
+			   if(outcome == Loop_Done)
+				   break;
+			   if(outcome == Loop_Returned)
+				   return Return;
+		   }
+		   if(!evaluate(condition))
+			   break;
+		   if(mJit)
+			   mJit->tick(mFunction);
+		   Completion completion = execute(wstmt->getBody());
+		   if(completion == Break)
+			   break;
+		   if(completion == Return || completion == TailCall)
+			   return completion;
 	   }
+	   return Normal;
    }
-   virtual void VisitForStmt(ForStmt * fstmt) {
-	   // no mEnv->handle?
-	   if(mEnv->getCurrentStack()->isRetState())
-		   return;
+   Completion executeFor(ForStmt * fstmt) {
 	   Stmt* finit = fstmt->getInit();
 	   Stmt* finc = fstmt->getInc();
 	   if(finit)
-			Visit(finit);
+			execute(finit);
 	   Expr* condition = fstmt->getCond();
-	   for(;mEnv->getExpr(condition); Visit(finc))
+	   hoist(fstmt);
+	   const InductionLoop * induction = mEnv->getNodes().induction(fstmt);
+	   if(induction) {
+		   if(induction->bound)
+			   mEnv->getCurrentStack()->bindDecl(induction->limit, evaluate(induction->bound));
+		   mEnv->startInduction(*induction);
+		   int64_t value = induction->value ? evaluate(induction->value) : 0;
+		   if(mEnv->runIdiom(*induction, value))
+			   return Normal;
+	   }
+	   for(;;)
 	   {
-		   Visit(fstmt->getBody());
+		   if(mTrace) {
+			   LoopOutcome outcome = mTrace->enter(fstmt);
+			   if(outcome == Loop_Done)
+				   break;
+			   if(outcome == Loop_Returned)
+				   return Return;
+			   if(outcome == Loop_Resumed && induction)
+				   mEnv->startInduction(*induction);
+		   }
+		   if(induction && induction->bound) {
+			   if(!mEnv->nextTrip(*induction))
+				   break;
+		   } else if(condition && !evaluate(condition))
+			   break;
+		   if(mJit)
+			   mJit->tick(mFunction);
+		   Completion completion = execute(fstmt->getBody());
+		   if(completion == Break)
+			   break;
+		   if(completion == Return || completion == TailCall)
+			   return completion;
+		   if(finc)
+			   execute(finc);
+		   if(induction)
+			   mEnv->stepInduction(*induction);
 	   }
+	   return Normal;
    }
    virtual void VisitIntegerLiteral(IntegerLiteral *intlt) {
-	   if(mEnv->getCurrentStack()->isRetState())
-		   return;
 	   VisitStmt(intlt);
 	   mEnv->intlt(intlt);
    }
    virtual void VisitCharacterLiteral(CharacterLiteral *charlt) {
-	   if(mEnv->getCurrentStack()->isRetState())
-		   return;
 	   VisitStmt(charlt);
 	   mEnv->chlt(charlt);
    }
-   virtual void VisitReturnStmt(ReturnStmt *rstmt) {
-	   if(mEnv->getCurrentStack()->isRetState())
-		   return;
-	   VisitStmt(rstmt);
-	   mEnv->rstmt(rstmt);
-   }
    virtual void VisitArraySubscriptExpr(ArraySubscriptExpr *ase) {
-	   VisitStmt(ase);
+	   const NodeInfo & node = mEnv->getNodes().lookup(ase);
+	   if(node.cursor) {
+		   mEnv->loadCursor(node);
+		   return;
+	   }
+	   Visit(ase->getBase());
+	   Visit(ase->getIdx());
 	   mEnv->arrayse(ase);
    }
    virtual void VisitUnaryExprOrTypeTraitExpr(UnaryExprOrTypeTraitExpr * uette) {
-	   if(mEnv->getCurrentStack()->isRetState())
-		   return;
-	   VisitStmt(uette);
+	   // the operand of sizeof is not evaluated
 	   mEnv->unaryOrtt(uette);
    }
    virtual void VisitParenExpr(ParenExpr * pe) {
-	   if(mEnv->getCurrentStack()->isRetState())
-		   return;
 	   VisitStmt(pe);
-	   mEnv->parene(pe);
    }
  
 private:
    Environment * mEnv;
+   JitTier * mJit;
+   TraceTier * mTrace;
+   MemoTable * mMemo;
+   /// FunctionLayout::index of the function being interpreted
+   unsigned mFunction;
+   /// Call of the last TailCall completion
+   CallExpr * mTailCall;
 };
 
 class InterpreterConsumer : public ASTConsumer {
 public:
-   explicit InterpreterConsumer(const ASTContext& context) : mEnv(),
+   explicit InterpreterConsumer(const ASTContext& context) : mEnv((size_t)StackBudget << 20),
    	   mVisitor(context, &mEnv) {
    }
    virtual ~InterpreterConsumer() {}
@@ -191,7 +440,62 @@ public:
 	   mEnv.init(decl);
 
 	   FunctionDecl * entry = mEnv.getEntry();
-	   mVisitor.VisitStmt(entry->getBody());
+	   if (!CompileImage.empty()) {
+		   BytecodeCompiler compiler(&mEnv);
+		   ProgramImage::write(CompileImage, compiler.compile(decl), mEnv);
+		   return;
+	   }
+	   if (Engine == BytecodeVM) {
+		   BytecodeCompiler compiler(&mEnv);
+		   BcModule & module = compiler.compile(decl);
+		   VM vm(module, &mEnv);
+		   vm.run();
+		   return;
+	   }
+	   if (Engine == ClosureTree) {
+		   ClosureEngine engine(&mEnv, decl);
+		   engine.run();
+		   return;
+	   }
+	   if (Engine == AheadOfTime) {
+		   Specializer specializer(&mEnv);
+		   ProgramCache cache(AotCache, Code);
+		   if (SpecializedMain guest = cache.build(specializer.emit(decl))) {
+			   guest();
+			   return;
+		   }
+		   llvm::errs() << "falling back to the tree walker\n";
+	   }
+	   if (Engine == BaselineNative) {
+		   BytecodeCompiler compiler(&mEnv);
+		   BcModule & module = compiler.compile(decl);
+		   BaselineCompiler baseline(module, &mEnv);
+		   baseline.run();
+		   return;
+	   }
+	   if (Engine == ContinuationStack) {
+		   StacklessInterpreter interpreter(&mEnv, (size_t)StackBudget << 20);
+		   interpreter.run(entry);
+		   return;
+	   }
+	   std::unique_ptr<JitTier> jit;
+	   std::unique_ptr<TraceTier> trace;
+	   if (JitThreshold || TraceThreshold) {
+		   jit.reset(new JitTier(&mEnv, decl, JitThreshold));
+		   mVisitor.setJit(jit.get(), mEnv.getLayout().getFunction(entry).index);
+	   }
+	   if (TraceThreshold) {
+		   trace.reset(new TraceTier(jit.get(), TraceThreshold));
+		   mVisitor.setTrace(trace.get());
+	   }
+	   std::unique_ptr<MemoTable> memo;
+	   if (MemoEntries) {
+		   memo.reset(new MemoTable(&mEnv, decl, MemoEntries));
+		   mVisitor.setMemo(memo.get());
+	   }
+	   mVisitor.execute(entry->getBody());
+	   if (memo)
+		   memo->report(llvm::errs());
   }
 private:
    Environment mEnv;
@@ -208,7 +512,28 @@ public:
 };
 
 int main (int argc, char ** argv) {
-   if (argc > 1) {
-       clang::tooling::runToolOnCode(std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction), argv[1]);
+   llvm::cl::ParseCommandLineOptions(argc, argv, "tiny C interpreter\n");
+   if (!RunImage.empty()) {
+       Environment env((size_t)StackBudget << 20);
+       BcModule module;
+       ProgramImage::load(RunImage, module, env);
+       VM vm(module, &env);
+       vm.run();
+       return 0;
+   }
+   if (!Code.empty()) {
+       /// A program specialized by an earlier run skips Clang altogether
+       if (Engine == AheadOfTime) {
+           if (SpecializedMain guest = ProgramCache(AotCache, Code).load()) {
+               guest();
+               return 0;
+           }
+       }
+       /// CodeGen compiles the guest as C, the other engines parse it as C++
+       if (Engine == SsaIR) {
+           clang::tooling::runToolOnCode(std::unique_ptr<clang::FrontendAction>(new SsaAction((size_t)StackBudget << 20)), Code, "input.c");
+           return 0;
+       }
+       clang::tooling::runToolOnCode(std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction), Code);
    }
 }
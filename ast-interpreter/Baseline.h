@@ -0,0 +1,312 @@
+//==--- Baseline.h - Copy-and-patch baseline compiler for x86-64 ----------===//
+//===----------------------------------------------------------------------===//
+#ifndef _BASELINE_H_
+#define _BASELINE_H_
+
+#include <string.h>
+#include <sys/mman.h>
+#include <initializer_list>
+#include <vector>
+
+#include "Bytecode.h"
+#include "Environment.h"
+#include "Runtime.h"
+
+/// What a hole of a stencil is patched with
+enum HoleKind : uint8_t {
+   Hole_A,		/// disp32, byte offset of register a in the frame
+   Hole_B,		/// disp32, byte offset of register b
+   Hole_C,		/// disp32, byte offset of register c
+   Hole_GA,		/// disp32, byte offset of data segment cell a
+   Hole_GB,		/// disp32, byte offset of data segment cell b
+   Hole_K,		/// imm64, consts[b]
+   Hole_Target,		/// rel32 to the code of instruction b
+   Hole_Callee,		/// rel32 to the prologue of function b
+   Hole_DivZero,	/// rel32 to the shared division by zero stub
+   Hole_Overflow,	/// rel32 to the shared stack overflow stub
+   Hole_Runtime,	/// imm64, the Runtime callback of the stencil
+   Hole_FrameSize,	/// disp32, byte size of the register window
+   Hole_Globals,	/// imm64, the data segment cells
+   Hole_Env,		/// imm64, the Environment
+   Hole_StackLimit,	/// imm64, lowest host stack address allowed
+   Hole_RegsEnd		/// imm64, end of the register file
+};
+
+/// Machine code of one operation with holes at fixed offsets
+struct Stencil {
+   struct Hole {
+	   uint32_t offset;
+	   HoleKind kind;
+   };
+   std::vector<uint8_t> code;
+   std::vector<Hole> holes;
+   const void * runtime = NULL;
+
+   Stencil & op(std::initializer_list<uint8_t> bytes) {
+	   code.insert(code.end(), bytes);
+	   return *this;
+   }
+   Stencil & hole(HoleKind kind) {
+	   Hole hole = { (uint32_t)code.size(), kind };
+	   holes.push_back(hole);
+	   code.resize(code.size() + (isImm64(kind) ? 8 : 4));
+	   return *this;
+   }
+   static bool isImm64(HoleKind kind) {
+	   return kind == Hole_K || kind == Hole_Runtime || kind == Hole_Globals || kind == Hole_Env
+		   || kind == Hole_StackLimit || kind == Hole_RegsEnd;
+   }
+};
+
+/// Baseline tier: every bytecode instruction has a pre-assembled x86-64
+/// stencil which is copied after the previous one, its holes patched with
+/// register offsets, constants and jump targets. There is no register
+/// allocation and no optimization, so a whole module is native code in one
+/// linear pass over the bytecode, in microseconds.
+///
+/// A guest function is a native function taking its register window; the
+/// frames live in the register file of the VM, the host stack only holds
+/// the return addresses. While guest code runs:
+///   rbx  the register window of the function
+///   r12  the data segment cells
+///   r13  the Environment, first argument of the Runtime callbacks
+///   r14  the stack region mark taken on entry, released on return
+class BaselineCompiler {
+   BcModule & mModule;
+   Environment * mEnv;
+   std::vector<int64_t> mRegs;
+   uintptr_t mStackLimit;
+   std::vector<Stencil> mStencils;
+   Stencil mPrologue;
+   Stencil mDivZero;
+   Stencil mOverflow;
+
+   /// Layout of the module in the code buffer
+   std::vector<size_t> mFunctionStart;
+   std::vector<std::vector<size_t>> mInstrStart;
+   size_t mDivZeroStart;
+   size_t mOverflowStart;
+   uint8_t * mCode;
+   size_t mCodeSize;
+public:
+   /// The stencils are x86-64 System V code
+   static constexpr bool Supported =
+#if defined(__x86_64__) && defined(__linux__)
+	   true;
+#else
+	   false;
+#endif
+
+   BaselineCompiler(BcModule & module, Environment * env, size_t numRegs = 1 << 20)
+   : mModule(module), mEnv(env), mRegs(numRegs), mStackLimit(Runtime::stackLimit()), mStencils(BC_Free + 1),
+	   mPrologue(), mDivZero(), mOverflow(), mFunctionStart(), mInstrStart(), mDivZeroStart(0),
+	   mOverflowStart(0), mCode(NULL), mCodeSize(0) {
+	   buildStencils();
+   }
+   ~BaselineCompiler() {
+	   if (mCode)
+		   munmap(mCode, mCodeSize);
+   }
+
+   /// Compile every function, then run the entry
+   int64_t run() {
+	   if (!Supported) {
+		   llvm::errs() << "the baseline engine needs x86-64 Linux\n";
+		   exit(0);
+	   }
+	   compile();
+	   typedef int64_t (*Entry)(int64_t * regs);
+	   Entry entry = (Entry)(mCode + mFunctionStart[mModule.entry]);
+	   return entry(mRegs.data());
+   }
+
+private:
+   void compile() {
+	   layout();
+	   size_t pageSize = 4096;
+	   mCodeSize = (mOverflowStart + mOverflow.code.size() + pageSize - 1) & ~(pageSize - 1);
+	   void * code = mmap(NULL, mCodeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	   if (code == MAP_FAILED) {
+		   llvm::errs() << "can not map " << mCodeSize << " bytes of code\n";
+		   exit(0);
+	   }
+	   mCode = (uint8_t *)code;
+	   Instr none = { BC_RetVoid, 0, 0, 0 };
+	   for (unsigned fn = 0; fn < mModule.functions.size(); fn++) {
+		   const BcFunction & f = mModule.functions[fn];
+		   copy(mPrologue, mFunctionStart[fn], fn, none);
+		   for (unsigned pc = 0; pc < f.code.size(); pc++)
+			   copy(mStencils[f.code[pc].op], mInstrStart[fn][pc], fn, f.code[pc]);
+	   }
+	   copy(mDivZero, mDivZeroStart, 0, none);
+	   copy(mOverflow, mOverflowStart, 0, none);
+	   if (mprotect(mCode, mCodeSize, PROT_READ | PROT_EXEC) != 0) {
+		   llvm::errs() << "can not make the code executable\n";
+		   exit(0);
+	   }
+   }
+
+   /// Stencil sizes are fixed, so every jump target is known before copying
+   void layout() {
+	   size_t offset = 0;
+	   mFunctionStart.resize(mModule.functions.size());
+	   mInstrStart.resize(mModule.functions.size());
+	   for (unsigned fn = 0; fn < mModule.functions.size(); fn++) {
+		   const BcFunction & f = mModule.functions[fn];
+		   mFunctionStart[fn] = offset;
+		   offset += mPrologue.code.size();
+		   mInstrStart[fn].resize(f.code.size());
+		   for (unsigned pc = 0; pc < f.code.size(); pc++) {
+			   mInstrStart[fn][pc] = offset;
+			   offset += mStencils[f.code[pc].op].code.size();
+		   }
+	   }
+	   mDivZeroStart = offset;
+	   mOverflowStart = offset + mDivZero.code.size();
+   }
+
+   void copy(const Stencil & stencil, size_t at, unsigned fn, const Instr & i) {
+	   const BcFunction & f = mModule.functions[fn];
+	   uint8_t * code = mCode + at;
+	   memcpy(code, stencil.code.data(), stencil.code.size());
+	   for (const Stencil::Hole & hole : stencil.holes) {
+		   uint8_t * where = code + hole.offset;
+		   size_t next = at + hole.offset + 4;
+		   switch (hole.kind) {
+			   case Hole_A: patch32(where, 8 * (int64_t)i.a); break;
+			   case Hole_B: patch32(where, 8 * (int64_t)i.b); break;
+			   case Hole_C: patch32(where, 8 * (int64_t)i.c); break;
+			   case Hole_GA: patch32(where, 8 * (int64_t)i.a); break;
+			   case Hole_GB: patch32(where, 8 * (int64_t)i.b); break;
+			   case Hole_K: patch64(where, f.consts[i.b]); break;
+			   case Hole_Target: patch32(where, (int64_t)mInstrStart[fn][i.b] - (int64_t)next); break;
+			   case Hole_Callee: patch32(where, (int64_t)mFunctionStart[i.b] - (int64_t)next); break;
+			   case Hole_DivZero: patch32(where, (int64_t)mDivZeroStart - (int64_t)next); break;
+			   case Hole_Overflow: patch32(where, (int64_t)mOverflowStart - (int64_t)next); break;
+			   case Hole_Runtime: patch64(where, (int64_t)stencil.runtime); break;
+			   case Hole_FrameSize: patch32(where, 8 * (int64_t)f.numRegs); break;
+			   case Hole_Globals: patch64(where, (int64_t)mEnv->getDataSegment().cells()); break;
+			   case Hole_Env: patch64(where, (int64_t)mEnv); break;
+			   case Hole_StackLimit: patch64(where, (int64_t)mStackLimit); break;
+			   case Hole_RegsEnd: patch64(where, (int64_t)(mRegs.data() + mRegs.size())); break;
+		   }
+	   }
+   }
+
+   void patch32(uint8_t * where, int64_t val) {
+	   if (val != (int32_t)val) {
+		   llvm::errs() << "baseline code out of the 32-bit range\n";
+		   exit(0);
+	   }
+	   int32_t val32 = (int32_t)val;
+	   memcpy(where, &val32, sizeof(val32));
+   }
+   void patch64(uint8_t * where, int64_t val) {
+	   memcpy(where, &val, sizeof(val));
+   }
+
+   /// ModRM bytes of mov reg, [rbx + disp32]
+   enum : uint8_t {
+	   RAX = 0x83,
+	   RCX = 0x8B,
+	   RDX = 0x93,
+	   RSI = 0xB3
+   };
+
+   static Stencil & load(Stencil & s, uint8_t modrm, HoleKind reg) {
+	   return s.op({ 0x48, 0x8B, modrm }).hole(reg);
+   }
+   /// mov [rbx + a], rax
+   static Stencil & storeA(Stencil & s) {
+	   return s.op({ 0x48, 0x89, 0x83 }).hole(Hole_A);
+   }
+   /// mov rdi, r13
+   static Stencil & envArg(Stencil & s) {
+	   return s.op({ 0x4C, 0x89, 0xEF });
+   }
+   /// mov rax, imm64; call rax
+   static Stencil & call(Stencil & s, const void * fn) {
+	   s.runtime = fn;
+	   return s.op({ 0x48, 0xB8 }).hole(Hole_Runtime).op({ 0xFF, 0xD0 });
+   }
+   /// add rsp, 8; pop r14; pop r13; pop r12; pop rbx; ret
+   static Stencil & epilogue(Stencil & s) {
+	   return s.op({ 0x48, 0x83, 0xC4, 0x08, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3 });
+   }
+   /// rax <- b, rcx <- c
+   static Stencil & binary(Stencil & s) {
+	   return load(load(s, RAX, Hole_B), RCX, Hole_C);
+   }
+   /// cmp rax, rcx; setcc al; movzx eax, al
+   static Stencil & compare(Stencil & s, uint8_t setcc) {
+	   return storeA(binary(s).op({ 0x48, 0x39, 0xC8, 0x0F, setcc, 0xC0, 0x0F, 0xB6, 0xC0 }));
+   }
+
+   void buildStencils() {
+	   // push rbx; push r12; push r13; push r14; sub rsp, 8; mov rbx, rdi
+	   mPrologue.op({ 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x48, 0x83, 0xEC, 0x08, 0x48, 0x89, 0xFB });
+	   mPrologue.op({ 0x49, 0xBC }).hole(Hole_Globals);
+	   mPrologue.op({ 0x49, 0xBD }).hole(Hole_Env);
+	   // mov rax, limit; cmp rsp, rax; jb overflow
+	   mPrologue.op({ 0x48, 0xB8 }).hole(Hole_StackLimit).op({ 0x48, 0x39, 0xC4, 0x0F, 0x82 }).hole(Hole_Overflow);
+	   // lea rax, [rbx + size]; mov rcx, end; cmp rax, rcx; ja overflow
+	   mPrologue.op({ 0x48, 0x8D, 0x83 }).hole(Hole_FrameSize);
+	   mPrologue.op({ 0x48, 0xB9 }).hole(Hole_RegsEnd).op({ 0x48, 0x39, 0xC8, 0x0F, 0x87 }).hole(Hole_Overflow);
+	   // mov r14, mark
+	   call(envArg(mPrologue), (const void *)&Runtime::mark).op({ 0x49, 0x89, 0xC6 });
+
+	   call(mDivZero, (const void *)&Runtime::divZero);
+	   call(mOverflow, (const void *)&Runtime::overflow);
+
+	   std::vector<Stencil> & s = mStencils;
+	   storeA(s[BC_LoadK].op({ 0x48, 0xB8 }).hole(Hole_K));
+	   storeA(load(s[BC_Mov], RAX, Hole_B));
+	   storeA(s[BC_LoadG].op({ 0x49, 0x8B, 0x84, 0x24 }).hole(Hole_GB));
+	   load(s[BC_StoreG], RAX, Hole_B).op({ 0x49, 0x89, 0x84, 0x24 }).hole(Hole_GA);
+	   storeA(binary(s[BC_Add]).op({ 0x48, 0x01, 0xC8 }));
+	   storeA(binary(s[BC_Sub]).op({ 0x48, 0x29, 0xC8 }));
+	   storeA(binary(s[BC_Mul]).op({ 0x48, 0x0F, 0xAF, 0xC1 }));
+	   // test rcx, rcx; je divzero; cqo; idiv rcx
+	   binary(s[BC_Div]).op({ 0x48, 0x85, 0xC9, 0x0F, 0x84 }).hole(Hole_DivZero);
+	   storeA(s[BC_Div].op({ 0x48, 0x99, 0x48, 0xF7, 0xF9 }));
+	   compare(s[BC_LT], 0x9C);
+	   compare(s[BC_GT], 0x9F);
+	   compare(s[BC_EQ], 0x94);
+	   // lea rax, [rax + rcx * 8]
+	   storeA(binary(s[BC_PtrAdd]).op({ 0x48, 0x8D, 0x04, 0xC8 }));
+	   storeA(load(s[BC_Neg], RAX, Hole_B).op({ 0x48, 0xF7, 0xD8 }));
+	   // mov rax, [rax] / movsx rax, byte [rax]
+	   storeA(load(s[BC_Load64], RAX, Hole_B).op({ 0x48, 0x8B, 0x00 }));
+	   storeA(load(s[BC_Load8], RAX, Hole_B).op({ 0x48, 0x0F, 0xBE, 0x00 }));
+	   // mov [rax], rcx / mov [rax], cl
+	   load(load(s[BC_Store64], RAX, Hole_A), RCX, Hole_B).op({ 0x48, 0x89, 0x08 });
+	   load(load(s[BC_Store8], RAX, Hole_A), RCX, Hole_B).op({ 0x88, 0x08 });
+	   // mov rax, [rax + rcx * 8] / movsx rax, byte [rax + rcx]
+	   storeA(binary(s[BC_Index64]).op({ 0x48, 0x8B, 0x04, 0xC8 }));
+	   storeA(binary(s[BC_Index8]).op({ 0x48, 0x0F, 0xBE, 0x04, 0x08 }));
+	   // mov [rax + rcx * 8], rdx / mov [rax + rcx], dl
+	   load(load(load(s[BC_StIndex64], RAX, Hole_A), RCX, Hole_B), RDX, Hole_C).op({ 0x48, 0x89, 0x14, 0xC8 });
+	   load(load(load(s[BC_StIndex8], RAX, Hole_A), RCX, Hole_B), RDX, Hole_C).op({ 0x88, 0x14, 0x08 });
+	   // mov rsi, consts[b]
+	   storeA(call(envArg(s[BC_Alloca]).op({ 0x48, 0xBE }).hole(Hole_K), (const void *)&Runtime::stackAllocate));
+	   storeA(call(envArg(s[BC_Mark]), (const void *)&Runtime::mark));
+	   call(load(envArg(s[BC_Release]), RSI, Hole_A), (const void *)&Runtime::release);
+	   s[BC_Jmp].op({ 0xE9 }).hole(Hole_Target);
+	   // test rax, rax; je target
+	   load(s[BC_Jz], RAX, Hole_A).op({ 0x48, 0x85, 0xC0, 0x0F, 0x84 }).hole(Hole_Target);
+	   // lea rdi, [rbx + c]; call callee
+	   storeA(s[BC_Call].op({ 0x48, 0x8D, 0xBB }).hole(Hole_C).op({ 0xE8 }).hole(Hole_Callee));
+	   // mov rsi, r14
+	   call(envArg(s[BC_Ret]).op({ 0x4C, 0x89, 0xF6 }), (const void *)&Runtime::release);
+	   epilogue(load(s[BC_Ret], RAX, Hole_A));
+	   call(envArg(s[BC_RetVoid]).op({ 0x4C, 0x89, 0xF6 }), (const void *)&Runtime::release);
+	   // xor eax, eax
+	   epilogue(s[BC_RetVoid].op({ 0x31, 0xC0 }));
+	   storeA(call(envArg(s[BC_Get]), (const void *)&Runtime::get));
+	   call(load(envArg(s[BC_Print]), RSI, Hole_A), (const void *)&Runtime::print);
+	   storeA(call(load(envArg(s[BC_Malloc]), RSI, Hole_B), (const void *)&Runtime::malloc));
+	   call(load(envArg(s[BC_Free]), RSI, Hole_A), (const void *)&Runtime::free);
+   }
+};
+
+#endif
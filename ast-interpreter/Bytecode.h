@@ -0,0 +1,552 @@
+//==--- Bytecode.h - Register bytecode for the AST interpreter -------------===//
+//===----------------------------------------------------------------------===//
+#ifndef _BYTECODE_H_
+#define _BYTECODE_H_
+
+#include <map>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/DenseMap.h"
+
+#include "Environment.h"
+
+using namespace clang;
+
+/// Opcodes of the register machine.
+/// Operands a, b, c are register indexes relative to the frame base
+/// unless the comment says otherwise.
+enum Opcode : uint8_t {
+   BC_LoadK,		/// a <- consts[b]
+   BC_Mov,		/// a <- b
+   BC_LoadG,		/// a <- data segment cell b
+   BC_StoreG,		/// data segment cell a <- b
+   BC_Add,		/// a <- b + c
+   BC_Sub,		/// a <- b - c
+   BC_Mul,		/// a <- b * c
+   BC_Div,		/// a <- b / c
+   BC_LT,		/// a <- b < c
+   BC_GT,		/// a <- b > c
+   BC_EQ,		/// a <- b == c
+   BC_PtrAdd,		/// a <- b + 8 * c
+   BC_Neg,		/// a <- -b
+   BC_Load64,		/// a <- *(int64_t *)b
+   BC_Load8,		/// a <- *(char *)b
+   BC_Store64,		/// *(int64_t *)a <- b
+   BC_Store8,		/// *(char *)a <- b
+   BC_Index64,		/// a <- ((int64_t *)b)[c]
+   BC_Index8,		/// a <- ((char *)b)[c]
+   BC_StIndex64,	/// ((int64_t *)a)[b] <- c
+   BC_StIndex8,		/// ((char *)a)[b] <- c
+   BC_Alloca,		/// a <- zeroed local array of consts[b] bytes
+   BC_Mark,		/// a <- top of the stack region
+   BC_Release,		/// release the stack region down to a
+   BC_Jmp,		/// pc <- b
+   BC_Jz,		/// if a == 0 then pc <- b
+   BC_Call,		/// a <- functions[b](c, c+1, ...), callee frame starts at c
+   BC_Ret,		/// return a
+   BC_RetVoid,		/// return 0
+   BC_Get,		/// a <- GET()
+   BC_Print,		/// PRINT(a)
+   BC_Malloc,		/// a <- MALLOC(b)
+   BC_Free,		/// FREE(a)
+};
+
+struct Instr {
+   Opcode op;
+   int32_t a;
+   int32_t b;
+   int32_t c;
+};
+
+/// A lowered function body. The parameters occupy registers 0..numParams-1
+/// so that a caller can evaluate the arguments straight into the callee frame.
+struct BcFunction {
+   FunctionDecl * decl;
+   unsigned numParams;
+   unsigned numRegs;
+   std::vector<Instr> code;
+   std::vector<int64_t> consts;
+};
+
+/// Code range of a WhileStmt/ForStmt. head is where every iteration starts
+/// testing the condition, the loop is left by jumping to or past end.
+struct BcLoop {
+   unsigned function;
+   unsigned head;
+   unsigned end;
+};
+
+struct BcModule {
+   std::vector<BcFunction> functions;
+   std::vector<VarDecl *> globals;
+   llvm::DenseMap<const Stmt *, BcLoop> loops;
+   unsigned entry;
+};
+
+/// Lowers every user FunctionDecl of a translation unit into register bytecode.
+/// Must run after Environment::init, which resolves the built-ins and the
+/// initial values of the globals.
+class BytecodeCompiler {
+   Environment * mEnv;
+   BcModule mModule;
+   FrameLayout & mLayout;
+   std::map<FunctionDecl *, unsigned> mFuncIndex;
+
+   /// Jumps out of a loop still waiting for their target
+   struct LoopExits {
+	   std::vector<unsigned> breaks;
+	   std::vector<unsigned> continues;
+	   /// Blocks with a stack region mark that were open when the loop began
+	   size_t outerMarks;
+   };
+
+   /// State of the function being compiled
+   BcFunction * mFn;
+   int32_t mTempTop;
+   /// Mark registers of the enclosing blocks that declare arrays
+   std::vector<int32_t> mMarks;
+   std::vector<LoopExits> mLoops;
+public:
+   explicit BytecodeCompiler(Environment * env) : mEnv(env), mModule(), mLayout(env->getLayout()), mFuncIndex(), mFn(NULL), mTempTop(0), mMarks(), mLoops() {
+   }
+
+   BcModule & compile(TranslationUnitDecl * unit) {
+	   for (Decl * decl : unit->decls()) {
+		   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl)) {
+			   assert(mLayout.getSlot(vardecl).index == mModule.globals.size());
+			   mModule.globals.push_back(vardecl);
+		   } else if (FunctionDecl * fdecl = dyn_cast<FunctionDecl>(decl)) {
+			   if (fdecl->doesThisDeclarationHaveABody()) {
+				   assert(mLayout.getFunction(fdecl).index == mModule.functions.size());
+				   mFuncIndex[fdecl] = mModule.functions.size();
+				   mModule.functions.push_back(BcFunction());
+				   mModule.functions.back().decl = fdecl;
+			   }
+		   }
+	   }
+	   for (unsigned i = 0; i < mModule.functions.size(); i++)
+		   compileFunction(&mModule.functions[i]);
+	   mModule.entry = functionIndex(mEnv->getEntry());
+	   return mModule;
+   }
+
+private:
+   unsigned functionIndex(FunctionDecl * fdecl) {
+	   FunctionDecl * def = fdecl->getDefinition();
+	   if (!def || mFuncIndex.find(def) == mFuncIndex.end()) {
+		   llvm::errs() << "can not find the body of " << fdecl->getName() << "\n";
+		   exit(0);
+	   }
+	   return mFuncIndex.find(def)->second;
+   }
+
+   /// Variables live in the registers numbered by their FrameLayout slot,
+   /// the temporaries are allocated above them.
+   void compileFunction(BcFunction * fn) {
+	   mFn = fn;
+	   const FunctionLayout & layout = mLayout.getFunction(fn->decl);
+	   fn->numParams = layout.numParams;
+	   fn->numRegs = layout.numSlots;
+	   mTempTop = layout.numSlots;
+	   compileStmt(fn->decl->getBody());
+	   emit(BC_RetVoid);
+   }
+
+   unsigned emit(Opcode op, int32_t a = 0, int32_t b = 0, int32_t c = 0) {
+	   Instr instr;
+	   instr.op = op;
+	   instr.a = a;
+	   instr.b = b;
+	   instr.c = c;
+	   mFn->code.push_back(instr);
+	   return mFn->code.size() - 1;
+   }
+   /// Patch the target of a forward jump to the next instruction
+   void patch(unsigned jump) {
+	   mFn->code[jump].b = mFn->code.size();
+   }
+   void patch(const std::vector<unsigned> & jumps) {
+	   for (unsigned jump : jumps)
+		   patch(jump);
+   }
+   int32_t constant(int64_t val) {
+	   for (unsigned i = 0; i < mFn->consts.size(); i++)
+		   if (mFn->consts[i] == val)
+			   return i;
+	   mFn->consts.push_back(val);
+	   return mFn->consts.size() - 1;
+   }
+   int32_t newTemp() {
+	   int32_t reg = mTempTop++;
+	   if ((unsigned)mTempTop > mFn->numRegs)
+		   mFn->numRegs = mTempTop;
+	   return reg;
+   }
+   int32_t target(int32_t dst) {
+	   return dst >= 0 ? dst : newTemp();
+   }
+   int32_t into(int32_t reg, int32_t dst) {
+	   if (dst >= 0 && dst != reg) {
+		   emit(BC_Mov, dst, reg);
+		   return dst;
+	   }
+	   return reg;
+   }
+   bool isLocal(VarDecl * vardecl) {
+	   return !mLayout.getSlot(vardecl).global;
+   }
+   int32_t slot(VarDecl * vardecl) {
+	   return mLayout.getSlot(vardecl).index;
+   }
+   static bool isCharElement(QualType type) {
+	   return type->isCharType();
+   }
+
+   void compileStmt(Stmt * stmt) {
+	   if (!stmt)
+		   return;
+	   int32_t temps = mTempTop;
+	   if (CompoundStmt * compound = dyn_cast<CompoundStmt>(stmt)) {
+		   /// a block declaring arrays hands their storage back when it ends
+		   int32_t mark = -1;
+		   if (declaresArray(compound)) {
+			   mark = newTemp();
+			   emit(BC_Mark, mark);
+			   mMarks.push_back(mark);
+		   }
+		   /// nothing follows a statement that always leaves the block
+		   unsigned live = mEnv->getNodes().lookup(compound).live;
+		   for (unsigned i = 0; i < live; i++)
+			   compileStmt(compound->body_begin()[i]);
+		   if (mark >= 0) {
+			   mMarks.pop_back();
+			   emit(BC_Release, mark);
+		   }
+	   } else if (DeclStmt * declstmt = dyn_cast<DeclStmt>(stmt)) {
+		   for (Decl * decl : declstmt->decls())
+			   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl))
+				   compileVarDecl(vardecl);
+	   } else if (IfStmt * ifstmt = dyn_cast<IfStmt>(stmt)) {
+		   int64_t taken;
+		   if (mEnv->getNodes().constant(ifstmt->getCond(), taken)) {
+			   compileStmt(taken ? ifstmt->getThen() : ifstmt->getElse());
+			   mTempTop = temps;
+			   return;
+		   }
+		   int32_t cond = compileExpr(ifstmt->getCond());
+		   mTempTop = temps;
+		   unsigned toElse = emit(BC_Jz, cond);
+		   compileStmt(ifstmt->getThen());
+		   if (ifstmt->getElse()) {
+			   unsigned toEnd = emit(BC_Jmp);
+			   patch(toElse);
+			   compileStmt(ifstmt->getElse());
+			   patch(toEnd);
+		   } else
+			   patch(toElse);
+	   } else if (WhileStmt * wstmt = dyn_cast<WhileStmt>(stmt)) {
+		   compileHoisted(wstmt);
+		   int32_t head = mFn->code.size();
+		   int32_t cond = compileExpr(wstmt->getCond());
+		   mTempTop = temps;
+		   unsigned toEnd = emit(BC_Jz, cond);
+		   beginLoop();
+		   compileStmt(wstmt->getBody());
+		   patch(mLoops.back().continues);
+		   emit(BC_Jmp, 0, head);
+		   patch(toEnd);
+		   endLoop();
+		   addLoop(wstmt, head);
+	   } else if (ForStmt * fstmt = dyn_cast<ForStmt>(stmt)) {
+		   compileStmt(fstmt->getInit());
+		   compileHoisted(fstmt);
+		   int32_t head = mFn->code.size();
+		   int toEnd = -1;
+		   if (fstmt->getCond()) {
+			   int32_t cond = compileExpr(fstmt->getCond());
+			   mTempTop = temps;
+			   toEnd = emit(BC_Jz, cond);
+		   }
+		   beginLoop();
+		   compileStmt(fstmt->getBody());
+		   patch(mLoops.back().continues);
+		   compileStmt(fstmt->getInc());
+		   emit(BC_Jmp, 0, head);
+		   if (toEnd >= 0)
+			   patch(toEnd);
+		   endLoop();
+		   addLoop(fstmt, head);
+	   } else if (ReturnStmt * rstmt = dyn_cast<ReturnStmt>(stmt)) {
+		   if (rstmt->getRetValue())
+			   emit(BC_Ret, compileExpr(rstmt->getRetValue()));
+		   else
+			   emit(BC_RetVoid);
+	   } else if (isa<BreakStmt>(stmt)) {
+		   leaveLoopBlocks();
+		   mLoops.back().breaks.push_back(emit(BC_Jmp));
+	   } else if (isa<ContinueStmt>(stmt)) {
+		   leaveLoopBlocks();
+		   mLoops.back().continues.push_back(emit(BC_Jmp));
+	   } else if (isa<NullStmt>(stmt)) {
+	   } else if (Expr * expr = dyn_cast<Expr>(stmt)) {
+		   compileExpr(expr);
+	   } else {
+		   llvm::errs() << "can not compile this Stmt\n";
+		   exit(0);
+	   }
+	   mTempTop = temps;
+   }
+
+   /// Operators invariant in loop are computed into their frame slot
+   /// registers ahead of its head
+   void compileHoisted(Stmt * loop) {
+	   int32_t temps = mTempTop;
+	   for (Expr * expr : mEnv->getNodes().hoistedBefore(loop)) {
+		   int32_t reg = mEnv->getNodes().lookup(expr).slot.index;
+		   if (BinaryOperator * bop = dyn_cast<BinaryOperator>(expr))
+			   compileBinary(bop, reg);
+		   else
+			   compileUnary(cast<UnaryOperator>(expr), reg);
+		   mTempTop = temps;
+	   }
+   }
+
+   void beginLoop() {
+	   LoopExits loop;
+	   loop.outerMarks = mMarks.size();
+	   mLoops.push_back(loop);
+   }
+   /// Breaks jump to the instruction following the loop
+   void endLoop() {
+	   patch(mLoops.back().breaks);
+	   mLoops.pop_back();
+   }
+   void addLoop(Stmt * loop, unsigned head) {
+	   BcLoop range = { (unsigned)(mFn - mModule.functions.data()), head, (unsigned)mFn->code.size() };
+	   mModule.loops[loop] = range;
+   }
+   /// A break or continue leaves the blocks opened inside the loop, so it
+   /// releases the stack region down to the outermost of them
+   void leaveLoopBlocks() {
+	   assert(!mLoops.empty() && "break or continue outside of a loop");
+	   if (mMarks.size() > mLoops.back().outerMarks)
+		   emit(BC_Release, mMarks[mLoops.back().outerMarks]);
+   }
+
+   static bool declaresArray(CompoundStmt * compound) {
+	   for (Stmt * child : compound->body())
+		   if (DeclStmt * declstmt = dyn_cast<DeclStmt>(child))
+			   for (Decl * decl : declstmt->decls())
+				   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl))
+					   if (isa<ConstantArrayType>(vardecl->getType().getTypePtr()))
+						   return true;
+	   return false;
+   }
+
+   void compileVarDecl(VarDecl * vardecl) {
+	   int32_t reg = slot(vardecl);
+	   const Type * type = vardecl->getType().getTypePtr();
+	   if (auto carray = dyn_cast<ConstantArrayType>(type)) {
+		   int64_t size = carray->getSize().getSExtValue();
+		   int64_t width = isCharElement(carray->getElementType()) ? 1 : 8;
+		   emit(BC_Alloca, reg, constant(size * width));
+	   } else if (vardecl->hasInit()) {
+		   compileExpr(vardecl->getInit(), reg);
+	   } else {
+		   emit(BC_LoadK, reg, constant(0));
+	   }
+   }
+
+   /// Compile an rvalue. The result is left in dst when dst >= 0,
+   /// otherwise in the returned register, which may be a variable register.
+   int32_t compileExpr(Expr * expr, int32_t dst = -1) {
+	   int64_t folded;
+	   if (mEnv->getNodes().constant(expr, folded)) {
+		   int32_t reg = target(dst);
+		   emit(BC_LoadK, reg, constant(folded));
+		   return reg;
+	   }
+	   if (IntegerLiteral * intlt = dyn_cast<IntegerLiteral>(expr)) {
+		   int32_t reg = target(dst);
+		   emit(BC_LoadK, reg, constant(intlt->getValue().getSExtValue()));
+		   return reg;
+	   } else if (CharacterLiteral * charlt = dyn_cast<CharacterLiteral>(expr)) {
+		   int32_t reg = target(dst);
+		   emit(BC_LoadK, reg, constant(charlt->getValue()));
+		   return reg;
+	   } else if (ParenExpr * pe = dyn_cast<ParenExpr>(expr)) {
+		   return compileExpr(pe->getSubExpr(), dst);
+	   } else if (CastExpr * castexpr = dyn_cast<CastExpr>(expr)) {
+		   return compileExpr(castexpr->getSubExpr(), dst);
+	   } else if (DeclRefExpr * declref = dyn_cast<DeclRefExpr>(expr)) {
+		   VarDecl * vardecl = dyn_cast<VarDecl>(declref->getDecl());
+		   if (!vardecl) {
+			   llvm::errs() << "can not compile this DeclRefExpr\n";
+			   exit(0);
+		   }
+		   if (isLocal(vardecl))
+			   return into(slot(vardecl), dst);
+		   int32_t reg = target(dst);
+		   emit(BC_LoadG, reg, slot(vardecl));
+		   return reg;
+	   } else if (UnaryExprOrTypeTraitExpr * uette = dyn_cast<UnaryExprOrTypeTraitExpr>(expr)) {
+		   if (uette->getKind() != UETT_SizeOf) {
+			   llvm::errs() << "can not compile this UnaryExprOrTypeTraitExpr\n";
+			   exit(0);
+		   }
+		   int32_t reg = target(dst);
+		   emit(BC_LoadK, reg, constant(isCharElement(uette->getTypeOfArgument()) ? 1 : 8));
+		   return reg;
+	   } else if (UnaryOperator * uop = dyn_cast<UnaryOperator>(expr)) {
+		   if (mEnv->getNodes().lookup(uop).hoisted)
+			   return into(mEnv->getNodes().lookup(uop).slot.index, dst);
+		   return compileUnary(uop, dst);
+	   } else if (ArraySubscriptExpr * ase = dyn_cast<ArraySubscriptExpr>(expr)) {
+		   int32_t base = compileExpr(ase->getBase());
+		   int32_t idx = compileExpr(ase->getIdx());
+		   int32_t reg = target(dst);
+		   emit(isCharElement(ase->getType()) ? BC_Index8 : BC_Index64, reg, base, idx);
+		   return reg;
+	   } else if (BinaryOperator * bop = dyn_cast<BinaryOperator>(expr)) {
+		   if (bop->isAssignmentOp())
+			   return compileAssign(bop, dst);
+		   if (mEnv->getNodes().lookup(bop).hoisted)
+			   return into(mEnv->getNodes().lookup(bop).slot.index, dst);
+		   return compileBinary(bop, dst);
+	   } else if (CallExpr * call = dyn_cast<CallExpr>(expr)) {
+		   return compileCall(call, dst);
+	   }
+	   llvm::errs() << "can not compile this Expr\n";
+	   exit(0);
+   }
+
+   int32_t compileUnary(UnaryOperator * uop, int32_t dst) {
+	   Expr * sub = uop->getSubExpr();
+	   switch (uop->getOpcode()) {
+		   case UO_Plus:
+			   return compileExpr(sub, dst);
+		   case UO_Minus: {
+			   int32_t val = compileExpr(sub);
+			   int32_t reg = target(dst);
+			   emit(BC_Neg, reg, val);
+			   return reg;
+		   }
+		   case UO_Deref: {
+			   int32_t ptr = compileExpr(sub);
+			   int32_t reg = target(dst);
+			   emit(isCharElement(uop->getType()) ? BC_Load8 : BC_Load64, reg, ptr);
+			   return reg;
+		   }
+		   default:
+			   llvm::errs() << "can not process this UOp\n";
+			   exit(0);
+	   }
+   }
+
+   int32_t compileBinary(BinaryOperator * bop, int32_t dst) {
+	   Expr * left = bop->getLHS();
+	   int32_t lhs = compileExpr(left);
+	   int32_t rhs = compileExpr(bop->getRHS());
+	   int32_t reg = target(dst);
+	   Opcode op;
+	   switch (bop->getOpcode()) {
+		   case BO_Add:
+			   if (left->getType()->isPointerType() &&
+					   !isCharElement(left->getType()->getPointeeType()))
+				   op = BC_PtrAdd;
+			   else
+				   op = BC_Add;
+			   break;
+		   case BO_Sub: op = BC_Sub; break;
+		   case BO_Mul: op = BC_Mul; break;
+		   case BO_Div: op = BC_Div; break;
+		   case BO_LT: op = BC_LT; break;
+		   case BO_GT: op = BC_GT; break;
+		   case BO_EQ: op = BC_EQ; break;
+		   default:
+			   llvm::errs() << "can not process this Op\n";
+			   exit(0);
+	   }
+	   emit(op, reg, lhs, rhs);
+	   return reg;
+   }
+
+   int32_t compileAssign(BinaryOperator * bop, int32_t dst) {
+	   if (bop->getOpcode() != BO_Assign) {
+		   llvm::errs() << "can not process this Op\n";
+		   exit(0);
+	   }
+	   Expr * left = bop->getLHS()->IgnoreParens();
+	   Expr * right = bop->getRHS();
+	   if (DeclRefExpr * declref = dyn_cast<DeclRefExpr>(left)) {
+		   VarDecl * vardecl = cast<VarDecl>(declref->getDecl());
+		   if (isLocal(vardecl)) {
+			   int32_t reg = slot(vardecl);
+			   compileExpr(right, reg);
+			   return into(reg, dst);
+		   }
+		   int32_t val = compileExpr(right, dst);
+		   emit(BC_StoreG, slot(vardecl), val);
+		   return val;
+	   } else if (ArraySubscriptExpr * ase = dyn_cast<ArraySubscriptExpr>(left)) {
+		   int32_t base = compileExpr(ase->getBase());
+		   int32_t idx = compileExpr(ase->getIdx());
+		   int32_t val = compileExpr(right, dst);
+		   emit(isCharElement(ase->getType()) ? BC_StIndex8 : BC_StIndex64, base, idx, val);
+		   return val;
+	   } else if (UnaryOperator * uop = dyn_cast<UnaryOperator>(left)) {
+		   if (uop->getOpcode() == UO_Deref) {
+			   int32_t ptr = compileExpr(uop->getSubExpr());
+			   int32_t val = compileExpr(right, dst);
+			   emit(isCharElement(uop->getType()) ? BC_Store8 : BC_Store64, ptr, val);
+			   return val;
+		   }
+	   }
+	   llvm::errs() << "can not assign to this Expr\n";
+	   exit(0);
+   }
+
+   int32_t compileCall(CallExpr * call, int32_t dst) {
+	   const CallTarget & callee = mEnv->getCalls().lookup(call);
+	   switch (callee.kind) {
+		   case Call_Get: {
+			   int32_t reg = target(dst);
+			   emit(BC_Get, reg);
+			   return reg;
+		   }
+		   case Call_Print:
+			   emit(BC_Print, compileExpr(call->getArg(0)));
+			   return target(dst);
+		   case Call_Malloc: {
+			   int32_t size = compileExpr(call->getArg(0));
+			   int32_t reg = target(dst);
+			   emit(BC_Malloc, reg, size);
+			   return reg;
+		   }
+		   case Call_Free:
+			   emit(BC_Free, compileExpr(call->getArg(0)));
+			   return target(dst);
+		   case Call_User:
+			   break;
+	   }
+	   if (!callee.def) {
+		   llvm::errs() << "can not find the body of " << call->getDirectCallee()->getName() << "\n";
+		   exit(0);
+	   }
+	   /// The arguments are evaluated into consecutive registers on top of
+	   /// the temporaries, which become the parameters of the callee frame.
+	   int32_t argBase = mTempTop;
+	   for (unsigned i = 0; i < call->getNumArgs(); i++)
+		   newTemp();
+	   for (unsigned i = 0; i < call->getNumArgs(); i++)
+		   compileExpr(call->getArg(i), argBase + i);
+	   int32_t reg = target(dst);
+	   emit(BC_Call, reg, functionIndex(callee.def), argBase);
+	   return reg;
+   }
+};
+
+#endif
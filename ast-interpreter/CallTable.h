@@ -0,0 +1,151 @@
+//==--- CallTable.h - Call sites resolved ahead of execution --------------===//
+//===----------------------------------------------------------------------===//
+#ifndef _CALLTABLE_H_
+#define _CALLTABLE_H_
+
+#include <stdlib.h>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "FrameLayout.h"
+#include "NodeTable.h"
+
+using namespace clang;
+
+/// What a call site dispatches to
+enum CallKind : uint8_t {
+   Call_User,
+   Call_Get,
+   Call_Print,
+   Call_Malloc,
+   Call_Free
+};
+
+/// A call site resolved once. For a user function it holds the definition,
+/// its body and the frame to set up; the arguments become slots
+/// 0..numParams-1 of that frame. A small function is inlined instead: its
+/// arguments become slots inlineBase.. of the caller's frame, and the
+/// expression it returns is evaluated there. A call in tail position
+/// replaces the frame of the caller instead of pushing one on top of it.
+struct CallTarget {
+   CallKind kind;
+   /// FunctionLayout::index of def
+   unsigned index;
+   FunctionDecl * def;
+   Stmt * body;
+   unsigned numParams;
+   unsigned numSlots;
+   Expr * inlined;
+   unsigned inlineBase;
+   bool tail;
+};
+
+/// Pre-pass resolving every CallExpr of the translation unit, so that a call
+/// costs one lookup instead of comparing its callee against the built-ins.
+class CallTable {
+   llvm::DenseMap<const FunctionDecl *, CallKind> mBuiltins;
+   llvm::DenseMap<const CallExpr *, CallTarget> mSites;
+   llvm::DenseMap<const ReturnStmt *, CallExpr *> mTails;
+   FrameLayout * mLayout;
+   NodeTable * mNodes;
+   /// Function whose body is being resolved
+   FunctionDecl * mFunction;
+public:
+   CallTable() : mBuiltins(), mSites(), mTails(), mLayout(NULL), mNodes(NULL), mFunction(NULL) {
+   }
+
+   /// Built-ins are registered before build, any redeclaration works
+   void addBuiltin(FunctionDecl * fdecl, CallKind kind) {
+	   if (fdecl)
+		   mBuiltins[fdecl->getCanonicalDecl()] = kind;
+   }
+
+   /// Runs after nodes, which decides what to inline and sizes the frames
+   void build(TranslationUnitDecl * unit, FrameLayout & layout, NodeTable & nodes) {
+	   mLayout = &layout;
+	   mNodes = &nodes;
+	   for (Decl * decl : unit->decls())
+		   if (FunctionDecl * fdecl = dyn_cast<FunctionDecl>(decl))
+			   if (fdecl->doesThisDeclarationHaveABody()) {
+				   mFunction = fdecl;
+				   resolveStmt(fdecl->getBody());
+			   }
+   }
+
+   const CallTarget & lookup(const CallExpr * call) {
+	   assert(mSites.find(call) != mSites.end());
+	   return mSites.find(call)->second;
+   }
+   /// The call rstmt returns the value of, if it is a tail call
+   CallExpr * tailCall(const ReturnStmt * rstmt) {
+	   auto it = mTails.find(rstmt);
+	   return it == mTails.end() ? NULL : it->second;
+   }
+
+private:
+   void resolveStmt(Stmt * stmt) {
+	   if (!stmt)
+		   return;
+	   if (CallExpr * call = dyn_cast<CallExpr>(stmt))
+		   resolve(call);
+	   for (Stmt * child : stmt->children())
+		   resolveStmt(child);
+	   if (ReturnStmt * rstmt = dyn_cast<ReturnStmt>(stmt))
+		   markTail(rstmt);
+   }
+
+   /// A user call whose value is returned as is ends the caller, which has
+   /// nothing left in its frame. The entry function has no caller to return
+   /// to, and arrays of the caller may be passed on, so their frames stay.
+   void markTail(ReturnStmt * rstmt) {
+	   Expr * value = rstmt->getRetValue();
+	   CallExpr * call = value ? dyn_cast<CallExpr>(value->IgnoreParenCasts()) : NULL;
+	   if (!call || mFunction->isMain() || declaresArray(mFunction->getBody()))
+		   return;
+	   CallTarget & target = mSites[call];
+	   if (target.kind != Call_User || !target.def || target.inlined)
+		   return;
+	   target.tail = true;
+	   mTails[rstmt] = call;
+   }
+   bool declaresArray(Stmt * stmt) {
+	   if (DeclStmt * declstmt = dyn_cast<DeclStmt>(stmt))
+		   for (Decl * decl : declstmt->decls())
+			   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl))
+				   if (mNodes->lookup(vardecl).handler == Node_DeclArray)
+					   return true;
+	   for (Stmt * child : stmt->children())
+		   if (child && declaresArray(child))
+			   return true;
+	   return false;
+   }
+
+   /// A user function without a body keeps a NULL def; calling it is an error
+   void resolve(CallExpr * call) {
+	   CallTarget target = { Call_User, 0, NULL, NULL, 0, 0, NULL, 0, false };
+	   FunctionDecl * callee = call->getDirectCallee();
+	   if (!callee) {
+		   llvm::errs() << "can not process an indirect call\n";
+		   exit(0);
+	   }
+	   auto builtin = mBuiltins.find(callee->getCanonicalDecl());
+	   if (builtin != mBuiltins.end()) {
+		   target.kind = builtin->second;
+	   } else if (FunctionDecl * def = callee->getDefinition()) {
+		   const FunctionLayout & layout = mLayout->getFunction(def);
+		   target.index = layout.index;
+		   target.def = def;
+		   target.body = def->getBody();
+		   target.numParams = layout.numParams;
+		   target.numSlots = layout.numSlots;
+		   target.inlined = mNodes->inlinedBody(def, target.inlineBase);
+	   }
+	   mSites[call] = target;
+   }
+};
+
+#endif
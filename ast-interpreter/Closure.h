@@ -0,0 +1,558 @@
+//==--- Closure.h - Closure-compiling engine ------------------------------===//
+//===----------------------------------------------------------------------===//
+#ifndef _CLOSURE_H_
+#define _CLOSURE_H_
+
+#include <memory>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+
+#include "Environment.h"
+#include "Runtime.h"
+
+class ClosureEngine;
+struct Closure;
+
+/// Evaluation state of one guest call
+struct ClosureFrame {
+   int64_t * vars;
+   int64_t ret;
+   ClosureEngine * engine;
+};
+
+/// An expression yields its value, a statement one of the Flow values
+typedef int64_t (*ClosureFn)(const Closure * self, ClosureFrame & frame);
+
+/// How a statement completed
+enum Flow : int64_t {
+   Flow_Normal,
+   Flow_Break,
+   Flow_Continue,
+   Flow_Return
+};
+
+/// A pre-bound node: its handler is chosen once for the operator, the kinds
+/// of the operands and the element width, so running it is one indirect
+/// call with the children and constants already in place.
+struct Closure {
+   ClosureFn run;
+   /// Constant, frame slot, cell address or function index
+   int64_t k;
+   /// Bytes of a local array
+   int64_t size;
+   const Closure * a;
+   const Closure * b;
+   const Closure * c;
+   const Closure * d;
+   /// Statements of a block, arguments of a call
+   std::vector<const Closure *> list;
+};
+
+/// Converts every function body into a tree of Closures once, after
+/// Environment::init, then runs main on it. Frames, globals, local arrays
+/// and the heap are those of Environment; guest calls recurse on the host
+/// stack, which is checked against Runtime::stackLimit.
+class ClosureEngine {
+   struct Function {
+	   const Closure * body;
+	   unsigned numSlots;
+   };
+
+   Environment * mEnv;
+   FrameLayout & mLayout;
+   std::vector<std::unique_ptr<Closure>> mNodes;
+   std::vector<Function> mFunctions;
+   uintptr_t mStackLimit;
+public:
+   static constexpr unsigned MaxArgs = 32;
+
+   ClosureEngine(Environment * env, TranslationUnitDecl * unit) : mEnv(env), mLayout(env->getLayout()),
+	   mNodes(), mFunctions(env->getLayout().getNumFunctions()), mStackLimit(Runtime::stackLimit()) {
+	   for (Decl * decl : unit->decls())
+		   if (FunctionDecl * fdecl = dyn_cast<FunctionDecl>(decl))
+			   if (fdecl->doesThisDeclarationHaveABody()) {
+				   Function & fn = mFunctions[mLayout.getFunction(fdecl).index];
+				   fn.body = compileStmt(fdecl->getBody());
+				   fn.numSlots = mLayout.getFunction(fdecl).numSlots;
+			   }
+   }
+
+   /// Runs main in the frame Environment::init pushed
+   int64_t run() {
+	   const Function & entry = mFunctions[mLayout.getFunction(mEnv->getEntry()).index];
+	   ClosureFrame frame = { mEnv->getCurrentStack()->getVars(), 0, this };
+	   entry.body->run(entry.body, frame);
+	   return frame.ret;
+   }
+
+private:
+   Closure * node(ClosureFn run, int64_t k = 0, const Closure * a = NULL, const Closure * b = NULL) {
+	   mNodes.emplace_back(new Closure());
+	   Closure * n = mNodes.back().get();
+	   n->run = run;
+	   n->k = k;
+	   n->a = a;
+	   n->b = b;
+	   return n;
+   }
+   static bool isCharElement(QualType type) {
+	   return type->isCharType();
+   }
+
+   // Operand kinds. A local or a constant operand is read in place instead
+   // of through the handler of its node.
+   struct Local {
+	   static int64_t get(const Closure * n, ClosureFrame & f) {
+		   return f.vars[n->k];
+	   }
+   };
+   struct Const {
+	   static int64_t get(const Closure * n, ClosureFrame & f) {
+		   return n->k;
+	   }
+   };
+   struct Eval {
+	   static int64_t get(const Closure * n, ClosureFrame & f) {
+		   return n->run(n, f);
+	   }
+   };
+
+   // Operators
+   struct Add {
+	   static int64_t apply(int64_t l, int64_t r) {
+		   return l + r;
+	   }
+   };
+   struct Sub {
+	   static int64_t apply(int64_t l, int64_t r) {
+		   return l - r;
+	   }
+   };
+   struct Mul {
+	   static int64_t apply(int64_t l, int64_t r) {
+		   return l * r;
+	   }
+   };
+   struct Div {
+	   static int64_t apply(int64_t l, int64_t r) {
+		   if (r == 0) {
+			   llvm::errs() << "div 0 errs\n";
+			   exit(0);
+		   }
+		   return l / r;
+	   }
+   };
+   struct PtrAdd {
+	   static int64_t apply(int64_t l, int64_t r) {
+		   return l + 8 * r;
+	   }
+   };
+   struct LT {
+	   static int64_t apply(int64_t l, int64_t r) {
+		   return l < r;
+	   }
+   };
+   struct GT {
+	   static int64_t apply(int64_t l, int64_t r) {
+		   return l > r;
+	   }
+   };
+   struct EQ {
+	   static int64_t apply(int64_t l, int64_t r) {
+		   return l == r;
+	   }
+   };
+
+   // Expression handlers
+   static int64_t constant(const Closure * self, ClosureFrame & f) {
+	   return self->k;
+   }
+   static int64_t loadLocal(const Closure * self, ClosureFrame & f) {
+	   return f.vars[self->k];
+   }
+   static int64_t loadGlobal(const Closure * self, ClosureFrame & f) {
+	   return *(int64_t *)self->k;
+   }
+   template <class Op, class L, class R>
+   static int64_t binary(const Closure * self, ClosureFrame & f) {
+	   return Op::apply(L::get(self->a, f), R::get(self->b, f));
+   }
+   static int64_t neg(const Closure * self, ClosureFrame & f) {
+	   return -self->a->run(self->a, f);
+   }
+   static int64_t load64(const Closure * self, ClosureFrame & f) {
+	   return Heap::load64(self->a->run(self->a, f));
+   }
+   static int64_t load8(const Closure * self, ClosureFrame & f) {
+	   return Heap::load8(self->a->run(self->a, f));
+   }
+   static int64_t index64(const Closure * self, ClosureFrame & f) {
+	   int64_t base = self->a->run(self->a, f);
+	   return Heap::load64(base + 8 * self->b->run(self->b, f));
+   }
+   static int64_t index8(const Closure * self, ClosureFrame & f) {
+	   int64_t base = self->a->run(self->a, f);
+	   return Heap::load8(base + self->b->run(self->b, f));
+   }
+   template <class R>
+   static int64_t storeLocal(const Closure * self, ClosureFrame & f) {
+	   return f.vars[self->k] = R::get(self->a, f);
+   }
+   static int64_t storeGlobal(const Closure * self, ClosureFrame & f) {
+	   return *(int64_t *)self->k = self->a->run(self->a, f);
+   }
+   static int64_t store64(const Closure * self, ClosureFrame & f) {
+	   int64_t ptr = self->a->run(self->a, f);
+	   int64_t val = self->b->run(self->b, f);
+	   Heap::store64(ptr, val);
+	   return val;
+   }
+   static int64_t store8(const Closure * self, ClosureFrame & f) {
+	   int64_t ptr = self->a->run(self->a, f);
+	   int64_t val = self->b->run(self->b, f);
+	   Heap::store8(ptr, val);
+	   return val;
+   }
+   static int64_t storeIndex64(const Closure * self, ClosureFrame & f) {
+	   int64_t base = self->a->run(self->a, f);
+	   int64_t idx = self->b->run(self->b, f);
+	   int64_t val = self->c->run(self->c, f);
+	   Heap::store64(base + 8 * idx, val);
+	   return val;
+   }
+   static int64_t storeIndex8(const Closure * self, ClosureFrame & f) {
+	   int64_t base = self->a->run(self->a, f);
+	   int64_t idx = self->b->run(self->b, f);
+	   int64_t val = self->c->run(self->c, f);
+	   Heap::store8(base + idx, val);
+	   return val;
+   }
+   static int64_t callGet(const Closure * self, ClosureFrame & f) {
+	   return f.engine->mEnv->input();
+   }
+   static int64_t callPrint(const Closure * self, ClosureFrame & f) {
+	   f.engine->mEnv->output(self->a->run(self->a, f));
+	   return 0;
+   }
+   static int64_t callMalloc(const Closure * self, ClosureFrame & f) {
+	   return f.engine->mEnv->allocate(self->a->run(self->a, f));
+   }
+   static int64_t callFree(const Closure * self, ClosureFrame & f) {
+	   f.engine->mEnv->deallocate(self->a->run(self->a, f));
+	   return 0;
+   }
+   /// The arguments are evaluated before the frame is pushed, a call among
+   /// them pushes and pops its own frame first
+   static int64_t callUser(const Closure * self, ClosureFrame & f) {
+	   ClosureEngine * engine = f.engine;
+	   if ((uintptr_t)__builtin_frame_address(0) < engine->mStackLimit)
+		   Runtime::overflow();
+	   int64_t args[MaxArgs];
+	   unsigned numArgs = self->list.size();
+	   for (unsigned i = 0; i < numArgs; i++)
+		   args[i] = self->list[i]->run(self->list[i], f);
+	   const Function & callee = engine->mFunctions[self->k];
+	   ClosureFrame frame = { engine->mEnv->pushStack(callee.numSlots), 0, engine };
+	   for (unsigned i = 0; i < numArgs; i++)
+		   frame.vars[i] = args[i];
+	   callee.body->run(callee.body, frame);
+	   engine->mEnv->popStack();
+	   return frame.ret;
+   }
+
+   // Statement handlers
+   static int64_t discard(const Closure * self, ClosureFrame & f) {
+	   self->a->run(self->a, f);
+	   return Flow_Normal;
+   }
+   static int64_t nop(const Closure * self, ClosureFrame & f) {
+	   return Flow_Normal;
+   }
+   static int64_t block(const Closure * self, ClosureFrame & f) {
+	   for (const Closure * stmt : self->list)
+		   if (int64_t flow = stmt->run(stmt, f))
+			   return flow;
+	   return Flow_Normal;
+   }
+   /// A block declaring arrays hands their storage back when it ends
+   static int64_t scopedBlock(const Closure * self, ClosureFrame & f) {
+	   StackRegion & region = f.engine->mEnv->getStackRegion();
+	   size_t mark = region.mark();
+	   int64_t flow = block(self, f);
+	   region.release(mark);
+	   return flow;
+   }
+   static int64_t declArray(const Closure * self, ClosureFrame & f) {
+	   f.vars[self->k] = f.engine->mEnv->getStackRegion().allocate(self->size);
+	   return Flow_Normal;
+   }
+   static int64_t ifThen(const Closure * self, ClosureFrame & f) {
+	   if (self->a->run(self->a, f))
+		   return self->b->run(self->b, f);
+	   return Flow_Normal;
+   }
+   static int64_t ifThenElse(const Closure * self, ClosureFrame & f) {
+	   if (self->a->run(self->a, f))
+		   return self->b->run(self->b, f);
+	   return self->c->run(self->c, f);
+   }
+   /// a init, b condition, c increment, d body; absent parts are nops
+   /// returning 1 as a condition
+   static int64_t loop(const Closure * self, ClosureFrame & f) {
+	   for (self->a->run(self->a, f); self->b->run(self->b, f); self->c->run(self->c, f)) {
+		   int64_t flow = self->d->run(self->d, f);
+		   if (flow == Flow_Break)
+			   break;
+		   if (flow == Flow_Return)
+			   return flow;
+	   }
+	   return Flow_Normal;
+   }
+   static int64_t returnValue(const Closure * self, ClosureFrame & f) {
+	   f.ret = self->a->run(self->a, f);
+	   return Flow_Return;
+   }
+   static int64_t returnVoid(const Closure * self, ClosureFrame & f) {
+	   return Flow_Return;
+   }
+   static int64_t breakLoop(const Closure * self, ClosureFrame & f) {
+	   return Flow_Break;
+   }
+   static int64_t continueLoop(const Closure * self, ClosureFrame & f) {
+	   return Flow_Continue;
+   }
+
+   const Closure * compileStmt(Stmt * stmt) {
+	   if (!stmt || isa<NullStmt>(stmt))
+		   return node(&nop);
+	   if (CompoundStmt * compound = dyn_cast<CompoundStmt>(stmt)) {
+		   bool scoped = false;
+		   Closure * n = node(&block);
+		   unsigned live = mEnv->getNodes().lookup(compound).live;
+		   for (Stmt * child : llvm::make_range(compound->body_begin(), compound->body_begin() + live)) {
+			   if (DeclStmt * declstmt = dyn_cast<DeclStmt>(child))
+				   for (Decl * decl : declstmt->decls())
+					   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl))
+						   scoped |= isa<ConstantArrayType>(vardecl->getType().getTypePtr());
+			   n->list.push_back(compileStmt(child));
+		   }
+		   if (scoped)
+			   n->run = &scopedBlock;
+		   return n;
+	   } else if (DeclStmt * declstmt = dyn_cast<DeclStmt>(stmt)) {
+		   Closure * n = node(&block);
+		   for (Decl * decl : declstmt->decls())
+			   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl))
+				   n->list.push_back(compileVarDecl(vardecl));
+		   return n;
+	   } else if (IfStmt * ifstmt = dyn_cast<IfStmt>(stmt)) {
+		   int64_t taken;
+		   if (mEnv->getNodes().constant(ifstmt->getCond(), taken))
+			   return compileStmt(taken ? ifstmt->getThen() : ifstmt->getElse());
+		   Closure * n = node(&ifThen, 0, compileExpr(ifstmt->getCond()), compileStmt(ifstmt->getThen()));
+		   if (ifstmt->getElse()) {
+			   n->run = &ifThenElse;
+			   n->c = compileStmt(ifstmt->getElse());
+		   }
+		   return n;
+	   } else if (WhileStmt * wstmt = dyn_cast<WhileStmt>(stmt)) {
+		   Closure * n = node(&loop, 0, node(&nop), compileExpr(wstmt->getCond()));
+		   n->c = node(&nop);
+		   n->d = compileStmt(wstmt->getBody());
+		   return n;
+	   } else if (ForStmt * fstmt = dyn_cast<ForStmt>(stmt)) {
+		   Closure * n = node(&loop, 0, compileStmt(fstmt->getInit()));
+		   n->b = fstmt->getCond() ? compileExpr(fstmt->getCond()) : node(&constant, 1);
+		   n->c = fstmt->getInc() ? compileExpr(fstmt->getInc()) : node(&nop);
+		   n->d = compileStmt(fstmt->getBody());
+		   return n;
+	   } else if (ReturnStmt * rstmt = dyn_cast<ReturnStmt>(stmt)) {
+		   if (rstmt->getRetValue())
+			   return node(&returnValue, 0, compileExpr(rstmt->getRetValue()));
+		   return node(&returnVoid);
+	   } else if (isa<BreakStmt>(stmt)) {
+		   return node(&breakLoop);
+	   } else if (isa<ContinueStmt>(stmt)) {
+		   return node(&continueLoop);
+	   } else if (Expr * expr = dyn_cast<Expr>(stmt)) {
+		   return node(&discard, 0, compileExpr(expr));
+	   }
+	   llvm::errs() << "can not compile this Stmt\n";
+	   exit(0);
+   }
+
+   const Closure * compileVarDecl(VarDecl * vardecl) {
+	   int64_t slot = mLayout.getSlot(vardecl).index;
+	   const Type * type = vardecl->getType().getTypePtr();
+	   if (auto carray = dyn_cast<ConstantArrayType>(type)) {
+		   Closure * n = node(&declArray, slot);
+		   n->size = carray->getSize().getSExtValue() * Environment::elementWidth(carray->getElementType());
+		   return n;
+	   }
+	   const Closure * init = vardecl->hasInit() ? compileExpr(vardecl->getInit()) : node(&constant, 0);
+	   return node(&discard, 0, node(pickStore(init), slot, init));
+   }
+
+   static ClosureFn pickStore(const Closure * val) {
+	   if (val->run == &loadLocal)
+		   return &storeLocal<Local>;
+	   if (val->run == &constant)
+		   return &storeLocal<Const>;
+	   return &storeLocal<Eval>;
+   }
+   template <class Op, class L>
+   static ClosureFn pickRight(const Closure * rhs) {
+	   if (rhs->run == &loadLocal)
+		   return &binary<Op, L, Local>;
+	   if (rhs->run == &constant)
+		   return &binary<Op, L, Const>;
+	   return &binary<Op, L, Eval>;
+   }
+   template <class Op>
+   static ClosureFn pickBinary(const Closure * lhs, const Closure * rhs) {
+	   if (lhs->run == &loadLocal)
+		   return pickRight<Op, Local>(rhs);
+	   if (lhs->run == &constant)
+		   return pickRight<Op, Const>(rhs);
+	   return pickRight<Op, Eval>(rhs);
+   }
+
+   const Closure * compileExpr(Expr * expr) {
+	   int64_t folded;
+	   if (mEnv->getNodes().constant(expr, folded))
+		   return node(&constant, folded);
+	   if (IntegerLiteral * intlt = dyn_cast<IntegerLiteral>(expr)) {
+		   return node(&constant, intlt->getValue().getSExtValue());
+	   } else if (CharacterLiteral * charlt = dyn_cast<CharacterLiteral>(expr)) {
+		   return node(&constant, charlt->getValue());
+	   } else if (ParenExpr * pe = dyn_cast<ParenExpr>(expr)) {
+		   return compileExpr(pe->getSubExpr());
+	   } else if (CastExpr * castexpr = dyn_cast<CastExpr>(expr)) {
+		   return compileExpr(castexpr->getSubExpr());
+	   } else if (DeclRefExpr * declref = dyn_cast<DeclRefExpr>(expr)) {
+		   VarDecl * vardecl = dyn_cast<VarDecl>(declref->getDecl());
+		   if (!vardecl) {
+			   llvm::errs() << "can not compile this DeclRefExpr\n";
+			   exit(0);
+		   }
+		   const VarSlot & slot = mLayout.getSlot(vardecl);
+		   if (slot.global)
+			   return node(&loadGlobal, (int64_t)(mEnv->getDataSegment().cells() + slot.index));
+		   return node(&loadLocal, slot.index);
+	   } else if (UnaryExprOrTypeTraitExpr * uette = dyn_cast<UnaryExprOrTypeTraitExpr>(expr)) {
+		   if (uette->getKind() != UETT_SizeOf) {
+			   llvm::errs() << "can not compile this UnaryExprOrTypeTraitExpr\n";
+			   exit(0);
+		   }
+		   return node(&constant, Environment::elementWidth(uette->getTypeOfArgument()));
+	   } else if (UnaryOperator * uop = dyn_cast<UnaryOperator>(expr)) {
+		   switch (uop->getOpcode()) {
+			   case UO_Plus:
+				   return compileExpr(uop->getSubExpr());
+			   case UO_Minus:
+				   return node(&neg, 0, compileExpr(uop->getSubExpr()));
+			   case UO_Deref:
+				   return node(isCharElement(uop->getType()) ? &load8 : &load64, 0, compileExpr(uop->getSubExpr()));
+			   default:
+				   llvm::errs() << "can not process this UOp\n";
+				   exit(0);
+		   }
+	   } else if (ArraySubscriptExpr * ase = dyn_cast<ArraySubscriptExpr>(expr)) {
+		   return node(isCharElement(ase->getType()) ? &index8 : &index64, 0,
+				   compileExpr(ase->getBase()), compileExpr(ase->getIdx()));
+	   } else if (BinaryOperator * bop = dyn_cast<BinaryOperator>(expr)) {
+		   if (bop->isAssignmentOp())
+			   return compileAssign(bop);
+		   return compileBinary(bop);
+	   } else if (CallExpr * call = dyn_cast<CallExpr>(expr)) {
+		   return compileCall(call);
+	   }
+	   llvm::errs() << "can not compile this Expr\n";
+	   exit(0);
+   }
+
+   const Closure * compileBinary(BinaryOperator * bop) {
+	   Expr * left = bop->getLHS();
+	   const Closure * lhs = compileExpr(left);
+	   const Closure * rhs = compileExpr(bop->getRHS());
+	   ClosureFn run;
+	   switch (bop->getOpcode()) {
+		   case BO_Add:
+			   if (left->getType()->isPointerType() && !isCharElement(left->getType()->getPointeeType()))
+				   run = pickBinary<PtrAdd>(lhs, rhs);
+			   else
+				   run = pickBinary<Add>(lhs, rhs);
+			   break;
+		   case BO_Sub: run = pickBinary<Sub>(lhs, rhs); break;
+		   case BO_Mul: run = pickBinary<Mul>(lhs, rhs); break;
+		   case BO_Div: run = pickBinary<Div>(lhs, rhs); break;
+		   case BO_LT: run = pickBinary<LT>(lhs, rhs); break;
+		   case BO_GT: run = pickBinary<GT>(lhs, rhs); break;
+		   case BO_EQ: run = pickBinary<EQ>(lhs, rhs); break;
+		   default:
+			   llvm::errs() << "can not process this Op\n";
+			   exit(0);
+	   }
+	   return node(run, 0, lhs, rhs);
+   }
+
+   const Closure * compileAssign(BinaryOperator * bop) {
+	   if (bop->getOpcode() != BO_Assign) {
+		   llvm::errs() << "can not process this Op\n";
+		   exit(0);
+	   }
+	   Expr * left = bop->getLHS()->IgnoreParens();
+	   if (DeclRefExpr * declref = dyn_cast<DeclRefExpr>(left)) {
+		   const VarSlot & slot = mLayout.getSlot(cast<VarDecl>(declref->getDecl()));
+		   const Closure * val = compileExpr(bop->getRHS());
+		   if (slot.global)
+			   return node(&storeGlobal, (int64_t)(mEnv->getDataSegment().cells() + slot.index), val);
+		   return node(pickStore(val), slot.index, val);
+	   } else if (ArraySubscriptExpr * ase = dyn_cast<ArraySubscriptExpr>(left)) {
+		   Closure * n = node(isCharElement(ase->getType()) ? &storeIndex8 : &storeIndex64, 0,
+				   compileExpr(ase->getBase()), compileExpr(ase->getIdx()));
+		   n->c = compileExpr(bop->getRHS());
+		   return n;
+	   } else if (UnaryOperator * uop = dyn_cast<UnaryOperator>(left)) {
+		   if (uop->getOpcode() == UO_Deref) {
+			   const Closure * ptr = compileExpr(uop->getSubExpr());
+			   return node(isCharElement(uop->getType()) ? &store8 : &store64, 0, ptr, compileExpr(bop->getRHS()));
+		   }
+	   }
+	   llvm::errs() << "can not assign to this Expr\n";
+	   exit(0);
+   }
+
+   const Closure * compileCall(CallExpr * call) {
+	   const CallTarget & callee = mEnv->getCalls().lookup(call);
+	   switch (callee.kind) {
+		   case Call_Get:
+			   return node(&callGet);
+		   case Call_Print:
+			   return node(&callPrint, 0, compileExpr(call->getArg(0)));
+		   case Call_Malloc:
+			   return node(&callMalloc, 0, compileExpr(call->getArg(0)));
+		   case Call_Free:
+			   return node(&callFree, 0, compileExpr(call->getArg(0)));
+		   case Call_User:
+			   break;
+	   }
+	   if (!callee.def) {
+		   llvm::errs() << "can not find the body of " << call->getDirectCallee()->getName() << "\n";
+		   exit(0);
+	   }
+	   if (call->getNumArgs() > MaxArgs) {
+		   llvm::errs() << "can not process more than " << MaxArgs << " arguments\n";
+		   exit(0);
+	   }
+	   Closure * n = node(&callUser, callee.index);
+	   for (unsigned i = 0; i < call->getNumArgs(); i++)
+		   n->list.push_back(compileExpr(call->getArg(i)));
+	   return n;
+   }
+};
+
+#endif
@@ -1,7 +1,16 @@
 //==--- tools/clang-check/ClangInterpreter.cpp - Clang Interpreter tool --------------===//
 //===----------------------------------------------------------------------===//
+#ifndef _ENVIRONMENT_H_
+#define _ENVIRONMENT_H_
+
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <algorithm>
 #include <utility>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/Decl.h"
@@ -10,34 +19,44 @@
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Tooling/Tooling.h"
 
+#include "FrameLayout.h"
+#include "CallTable.h"
+#include "NodeTable.h"
+
 using namespace clang;
 
 class StackFrame {
-   /// StackFrame maps Variable Declaration to Value
+   /// StackFrame maps the slot of a Variable Declaration to Value
    /// Which are either integer or addresses (also represented using an Integer value)
-   std::map<Decl*, int64_t> mVars;
-   std::map<Stmt*, int64_t> mExprs;
+   int64_t * mVars;
+   unsigned mNumVars;
    /// The current stmt
    Stmt * mPC;
    bool mretflag = false;
    int64_t mretval;
+   /// Top of the StackRegion when the frame was pushed
+   size_t mRegionMark;
 public:
-   StackFrame() : mVars(), mExprs(), mPC() {
+   StackFrame(int64_t * vars, unsigned numVars, size_t regionMark) : mVars(vars), mNumVars(numVars), mPC(), mRegionMark(regionMark) {
    }
 
-   void bindDecl(Decl* decl, int64_t val) {
-      mVars[decl] = val;
+   void bindDecl(unsigned slot, int64_t val) {
+      assert (slot < mNumVars);
+      mVars[slot] = val;
    }    
-   int64_t getDeclVal(Decl * decl) {
-      assert (mVars.find(decl) != mVars.end());
-      return mVars.find(decl)->second;
+   int64_t getDeclVal(unsigned slot) {
+      assert (slot < mNumVars);
+      return mVars[slot];
    }
-   void bindStmt(Stmt * stmt, int64_t val) {
-	   mExprs[stmt] = val;
+   unsigned getNumVars() {
+	   return mNumVars;
    }
-   int64_t getStmtVal(Stmt * stmt) {
-	   assert (mExprs.find(stmt) != mExprs.end());
-	   return mExprs[stmt];
+   /// Slots of the frame, in FrameLayout order
+   int64_t * getVars() {
+	   return mVars;
+   }
+   size_t getRegionMark() {
+	   return mRegionMark;
    }
    void setPC(Stmt * stmt) {
 	   mPC = stmt;
@@ -45,14 +64,6 @@ public:
    Stmt * getPC() {
 	   return mPC;
    }
-   bool declExits(Decl * decl)
-   {
-	   return mVars.find(decl) != mVars.end();
-   }
-   bool exprExits(Stmt * stmt)
-   {
-	   return mExprs.find(stmt) != mExprs.end();
-   }
    void setRetVal(int64_t val)
    {
 	   mretflag = true;
@@ -66,73 +77,367 @@ public:
    {
 	   return mretval; 
    }
-   bool isRetState()
-   {
-	   return mretflag;
+};
+
+/// Address range reserved up front; pages are only committed when touched,
+/// so the stacks below can be sized by a generous budget
+class Reservation {
+   char * mBase;
+   size_t mSize;
+public:
+   Reservation(size_t size, const char * what) : mBase(NULL), mSize(size) {
+	   void * base = mmap(NULL, mSize, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	   if (base == MAP_FAILED) {
+		   llvm::errs() << "can not reserve the " << what << "\n";
+		   exit(0);
+	   }
+	   mBase = (char *)base;
    }
+   ~Reservation() {
+	   munmap(mBase, mSize);
+   }
+   Reservation(const Reservation &) = delete;
+   Reservation & operator=(const Reservation &) = delete;
+
+   char * base() {
+	   return mBase;
+   }
+   size_t size() {
+	   return mSize;
+   }
+};
+
+/// Contiguous storage the variable slots of every StackFrame are drawn from
+class FrameStack {
+   Reservation mMemory;
+   int64_t * mSlots;
+   size_t mCapacity;
+   size_t mTop;
+public:
+   explicit FrameStack(size_t bytes) : mMemory(bytes, "frame stack"),
+	   mSlots((int64_t *)mMemory.base()), mCapacity(bytes / sizeof(int64_t)), mTop(0) {
+   }
+   int64_t * push(unsigned size) {
+	   if (mTop + size > mCapacity) {
+		   llvm::errs() << "stack overflow\n";
+		   exit(0);
+	   }
+	   int64_t * slots = mSlots + mTop;
+	   mTop += size;
+	   return slots;
+   }
+   void pop(unsigned size) {
+	   mTop -= size;
+   }
+};
+
+/// Contiguous stack carrying the values of evaluated sub-expressions.
+/// Every evaluated Expr leaves exactly one value on it, which its parent consumes.
+class OperandStack {
+   Reservation mMemory;
+   int64_t * mValues;
+   size_t mCapacity;
+   size_t mTop;
+public:
+   explicit OperandStack(size_t bytes) : mMemory(bytes, "operand stack"),
+	   mValues((int64_t *)mMemory.base()), mCapacity(bytes / sizeof(int64_t)), mTop(0) {
+   }
+   void push(int64_t val) {
+	   if (mTop == mCapacity) {
+		   llvm::errs() << "operand stack overflow\n";
+		   exit(0);
+	   }
+	   mValues[mTop++] = val;
+   }
+   int64_t pop() {
+	   assert(mTop > 0);
+	   return mValues[--mTop];
+   }
+   /// The n topmost values, oldest first
+   int64_t * top(unsigned n) {
+	   assert(n <= mTop);
+	   return mValues + mTop - n;
+   }
+   void drop(unsigned n) {
+	   assert(n <= mTop);
+	   mTop -= n;
+   }
+   size_t size() {
+	   return mTop;
+   }
+};
+
+/// Data segment of the guest, laid out once by Environment::init: a cell
+/// per global variable, indexed by its FrameLayout slot, followed by the
+/// storage of the global arrays. Array cells hold the address of their storage.
+class DataSegment {
+   std::vector<int64_t> mWords;
+   unsigned mNumCells;
+public:
+   DataSegment() : mWords(), mNumCells(0) {
+   }
+   void layout(unsigned numCells, size_t arrayBytes) {
+	   mNumCells = numCells;
+	   mWords.assign(numCells + (arrayBytes + 7) / 8, 0);
+   }
+   int64_t * cells() {
+	   return mWords.data();
+   }
+   /// Words of the cells and of the global arrays
+   size_t size() {
+	   return mWords.size();
+   }
+   int64_t get(unsigned idx) {
+	   assert(idx < mNumCells);
+	   return mWords[idx];
+   }
+   void set(unsigned idx, int64_t val) {
+	   assert(idx < mNumCells);
+	   mWords[idx] = val;
+   }
+   /// Guest address of the array storage at offset
+   int64_t arrayAddress(size_t offset) {
+	   return (int64_t)(mWords.data() + mNumCells) + offset;
+   }
+};
+
+/// Stack region the local arrays of every frame are carved from.
+/// Releasing a frame or a block only resets the top. Pages above the
+/// highest offset ever handed out are still untouched zero pages of the
+/// mapping, and big reused ranges are dropped back to the kernel instead
+/// of being cleared, so large arrays are zeroed lazily on first touch.
+class StackRegion {
+	static constexpr size_t Align = 16;
+	static constexpr size_t PageSize = 4096;
+	static constexpr size_t LazyZeroBytes = 16 * PageSize;
+
+	Reservation mMemory;
+	char * mBase;
+	size_t mCapacity;
+	size_t mTop;
+	/// Everything from mClean up has never been written
+	size_t mClean;
+public:
+	explicit StackRegion(size_t capacity) : mMemory(capacity, "stack region"),
+		mBase(mMemory.base()), mCapacity(capacity), mTop(0), mClean(0) {
+	}
+
+	size_t mark() {
+		return mTop;
+	}
+	void release(size_t mark) {
+		assert(mark <= mTop);
+		mTop = mark;
+	}
+	/// A zeroed block of size bytes
+	int64_t allocate(int64_t size) {
+		size_t bytes = (size + Align - 1) & ~(Align - 1);
+		if (mTop + bytes > mCapacity) {
+			llvm::errs() << "stack overflow\n";
+			exit(0);
+		}
+		char * ptr = mBase + mTop;
+		size_t end = mTop + bytes;
+		if (mTop < mClean)
+			zero(ptr, std::min(end, mClean) - mTop);
+		mTop = end;
+		if (end > mClean)
+			mClean = end;
+		return (int64_t)ptr;
+	}
+
+private:
+	void zero(char * ptr, size_t size) {
+		if (size < LazyZeroBytes) {
+			memset(ptr, 0, size);
+			return;
+		}
+		char * first = (char *)(((uintptr_t)ptr + PageSize - 1) & ~(PageSize - 1));
+		char * last = (char *)(((uintptr_t)ptr + size) & ~(PageSize - 1));
+		memset(ptr, 0, first - ptr);
+		madvise(first, last - first, MADV_DONTNEED);
+		memset(last, 0, ptr + size - last);
+	}
 };
 
-/// Heap maps address to a value
+/// Guest heap: one contiguous arena reserved up front and released in bulk
+/// when the Environment goes away. Small chunks are recycled through
+/// per-size-class free lists, fresh ones are bump allocated.
+/// Every guest load and store goes through the accessors below.
 class Heap {
-	// addr->size 
-	std::map<int64_t, int64_t> mChunks;
-	// offset->value int8_t
-	std::map<int64_t, int8_t> mContents;
+	/// Header in front of every chunk
+	struct Chunk {
+		uint64_t size;
+		uint32_t magic;
+		uint32_t sizeClass;
+	};
+	static constexpr size_t Granule = sizeof(Chunk);
+	/// Classes 0..NumClasses-1 hold chunks of (class+1)*Granule bytes,
+	/// the last list holds every larger chunk
+	static constexpr unsigned NumClasses = 16;
+	static constexpr uint32_t LiveMagic = 0xa110c8ed;
+	static constexpr uint32_t FreeMagic = 0xf2eef2ee;
+
+	Reservation mMemory;
+	char * mArena;
+	size_t mCapacity;
+	size_t mTop;
+	char * mFreeLists[NumClasses + 1];
 public:
-	Heap(): mChunks(), mContents(){}
+	explicit Heap(size_t capacity = (size_t)1 << 30) : mMemory(capacity, "guest heap"),
+		mArena(mMemory.base()), mCapacity(capacity), mTop(0) {
+		for (unsigned i = 0; i <= NumClasses; i++)
+			mFreeLists[i] = NULL;
+	}
+
 	int64_t Malloc(int64_t size)
 	{
-		int64_t *ptr = (int64_t *) std::malloc(size);
-		
-		mChunks.insert(std::make_pair((int64_t)ptr, size));
-		for(int64_t i = 0; i < size; i++)
-			mContents.insert(std::make_pair((int64_t)(ptr+1), 0));
-		return (int64_t)ptr;
+		if (size < 0) {
+			llvm::errs() << "invalid malloc size " << size << "\n";
+			exit(0);
+		}
+		uint64_t bytes = size == 0 ? Granule : (size + Granule - 1) / Granule * Granule;
+		unsigned sizeClass = bytes <= NumClasses * Granule ? bytes / Granule - 1 : NumClasses;
+
+		char * payload = NULL;
+		char ** link = &mFreeLists[sizeClass];
+		for (; *link; link = (char **)*link) {
+			if (header(*link)->size >= bytes) {
+				payload = *link;
+				*link = *(char **)payload;
+				break;
+			}
+		}
+		if (!payload) {
+			if (mTop + Granule + bytes > mCapacity) {
+				llvm::errs() << "guest heap exhausted\n";
+				exit(0);
+			}
+			payload = mArena + mTop + Granule;
+			mTop += Granule + bytes;
+			header(payload)->size = bytes;
+			header(payload)->sizeClass = sizeClass;
+		}
+		header(payload)->magic = LiveMagic;
+		return (int64_t)payload;
 	}
 	void Free(int64_t addr)
 	{
-		assert(mChunks.find(addr) != mChunks.end());
-		int64_t * ptr = (int64_t *)addr;
-		int64_t size = mChunks.find(addr)->second;
-		mChunks.erase(mChunks.find(addr));
-
-		for(int64_t i = 0; i < size; i++)
-		{
-			assert(mContents.find((int64_t)(ptr+i)) != mContents.end());
-			mContents.erase((int64_t)(ptr+i));
+		if (addr == 0)
+			return;
+		char * payload = (char *)addr;
+		if (payload < mArena + Granule || payload >= mArena + mTop ||
+				(payload - mArena) % Granule != 0) {
+			llvm::errs() << "invalid free of " << (void *)payload << "\n";
+			exit(0);
 		}
-		std::free(ptr);
+		Chunk * chunk = header(payload);
+		if (chunk->magic == FreeMagic) {
+			llvm::errs() << "double free of " << (void *)payload << "\n";
+			exit(0);
+		}
+		if (chunk->magic != LiveMagic) {
+			llvm::errs() << "invalid free of " << (void *)payload << "\n";
+			exit(0);
+		}
+		chunk->magic = FreeMagic;
+		*(char **)payload = mFreeLists[chunk->sizeClass];
+		mFreeLists[chunk->sizeClass] = payload;
 	}
 
-	void UpdateInt8(int64_t addr, int8_t val)
+	static int64_t load64(int64_t addr)
 	{
-		assert(mContents.find(addr) != mContents.end());
-		mContents[addr] = val;
+		return *(int64_t *)addr;
 	}
-	void UpdateInt64(int64_t addr, int64_t val)
+	static int64_t load8(int64_t addr)
 	{
-		for(int i = 0; i < 8; i++)
-		{
-			UpdateInt8(addr, val&0xff);
-			val >>= 8;
-		}
+		return *(char *)addr;
 	}
-	int8_t GetInt8(int64_t addr)
+	static void store64(int64_t addr, int64_t val)
 	{
-		assert(mContents.find(addr) != mContents.end());
-		return mContents.find(addr)->second;
+		*(int64_t *)addr = val;
 	}
-	int64_t GetInt64(int64_t addr)
+	static void store8(int64_t addr, int64_t val)
+	{
+		*(char *)addr = (char)val;
+	}
+
+	/// Kernels of the loop idioms, over n elements from addr
+	static void fill64(int64_t addr, int64_t n, int64_t val)
 	{
-		int64_t val = 0;
-		for(int i = 0; i < 8; i++)
-			val += (GetInt8(addr+i))<<(i*8);
-		return val;
+		if (val == 0)
+			memset((void *)addr, 0, n * 8);
+		else
+			std::fill_n((int64_t *)addr, n, val);
 	}
+	static void fill8(int64_t addr, int64_t n, int64_t val)
+	{
+		memset((void *)addr, (char)val, n);
+	}
+	/// Sums wrap around like the additions of the guest
+	static int64_t sum64(int64_t addr, int64_t n)
+	{
+		const int64_t * elements = (const int64_t *)addr;
+		uint64_t sum = 0;
+		int64_t i = 0;
+#ifdef __AVX2__
+		__m256i lanes = _mm256_setzero_si256();
+		for (; i + 4 <= n; i += 4)
+			lanes = _mm256_add_epi64(lanes, _mm256_loadu_si256((const __m256i *)(elements + i)));
+		uint64_t partial[4];
+		_mm256_storeu_si256((__m256i *)partial, lanes);
+		sum = partial[0] + partial[1] + partial[2] + partial[3];
+#endif
+		for (; i < n; i++)
+			sum += (uint64_t)elements[i];
+		return (int64_t)sum;
+	}
+	static int64_t sum8(int64_t addr, int64_t n)
+	{
+		const char * elements = (const char *)addr;
+		uint64_t sum = 0;
+		for (int64_t i = 0; i < n; i++)
+			sum += (uint64_t)(int64_t)elements[i];
+		return (int64_t)sum;
+	}
+
+private:
+	static Chunk * header(char * payload)
+	{
+		return (Chunk *)payload - 1;
+	}
+};
+
+/// Guest memory access of an element of Width bytes
+template <unsigned Width> struct ElementAccess;
+template <> struct ElementAccess<1> {
+   static int64_t load(int64_t addr) {
+	   return Heap::load8(addr);
+   }
+   static void store(int64_t addr, int64_t val) {
+	   Heap::store8(addr, val);
+   }
+};
+template <> struct ElementAccess<8> {
+   static int64_t load(int64_t addr) {
+	   return Heap::load64(addr);
+   }
+   static void store(int64_t addr, int64_t val) {
+	   Heap::store64(addr, val);
+   }
 };
 
 class Environment {
+   FrameLayout mLayout;
+   CallTable mCalls;
+   NodeTable mNodes;
+   FrameStack mSlots;
    std::vector<StackFrame> mStack;
+   DataSegment mData;
+   OperandStack mOperands;
+   Heap mHeap;
+   StackRegion mRegion;
 
    FunctionDecl * mFree;				/// Declartions to the built-in functions
    FunctionDecl * mMalloc;
@@ -140,29 +445,74 @@ class Environment {
    FunctionDecl * mOutput;
 
    FunctionDecl * mEntry;
+   ASTContext * mContext;
 public:
-   /// Get the declartions to the built-in functions
-   Environment() : mStack(), mFree(NULL), mMalloc(NULL), mInput(NULL), mOutput(NULL), mEntry(NULL) {
+   /// stackBudget bounds each of the frame stack, the operand stack and the
+   /// stack region, and with them the depth of guest recursion
+   explicit Environment(size_t stackBudget = (size_t)256 << 20) : mLayout(), mCalls(), mNodes(), mSlots(stackBudget), mStack(), mData(), mOperands(stackBudget), mHeap(), mRegion(stackBudget), mFree(NULL), mMalloc(NULL), mInput(NULL), mOutput(NULL), mEntry(NULL), mContext(NULL) {
    }
 
+   FrameLayout & getLayout() {
+	   return mLayout;
+   }
+   CallTable & getCalls() {
+	   return mCalls;
+   }
+   NodeTable & getNodes() {
+	   return mNodes;
+   }
+   void pushStack(FunctionDecl * fdecl) {
+	   pushStack(mLayout.getFunction(fdecl).numSlots);
+   }
+   int64_t * pushStack(unsigned size) {
+	   int64_t * vars = mSlots.push(size);
+	   mStack.push_back(StackFrame(vars, size, mRegion.mark()));
+	   return vars;
+   }
+   /// Releases the variable slots and the local arrays of the frame in O(1)
    void popStack() {
+	   mSlots.pop(mStack.back().getNumVars());
+	   mRegion.release(mStack.back().getRegionMark());
 	   mStack.pop_back();
    }
+   StackRegion & getStackRegion() {
+	   return mRegion;
+   }
    StackFrame* getCurrentStack() {
 	   return &(mStack.back()); 
    }
+   DataSegment & getDataSegment() {
+	   return mData;
+   }
    int64_t getStackDeclVal(Decl * decl) {
-	   StackFrame globalStack = mStack.front();
-	   StackFrame currentStack = mStack.back();
-	   if(currentStack.declExits(decl))
-		   return currentStack.getDeclVal(decl);
+	   return getSlotVal(mLayout.getSlot(cast<VarDecl>(decl)));
+   }
+   void bindStackDecl(Decl * decl, int64_t val) {
+	   bindSlot(mLayout.getSlot(cast<VarDecl>(decl)), val);
+   }
+   int64_t getSlotVal(const VarSlot & slot) {
+	   if(slot.global)
+		   return mData.get(slot.index);
+	   else
+		   return mStack.back().getDeclVal(slot.index);
+   }
+   void bindSlot(const VarSlot & slot, int64_t val) {
+	   if(slot.global)
+		   mData.set(slot.index, val);
 	   else
-		   return globalStack.getDeclVal(decl);
+		   mStack.back().bindDecl(slot.index, val);
+   }
+
+   /// Bytes of an array element: chars are packed, everything else is 8 bytes
+   static int64_t elementWidth(QualType element) {
+	   return element->isCharType() ? 1 : 8;
    }
 
    /// Initialize the Environment
    void init(TranslationUnitDecl * unit) {
-	   mStack.push_back(StackFrame());
+	   mContext = &unit->getASTContext();
+	   mLayout.build(unit);
+	   size_t arrayBytes = 0;
 	   for (TranslationUnitDecl::decl_iterator i =unit->decls_begin(), e = unit->decls_end(); i != e; ++ i) {
 		   if (FunctionDecl * fdecl = dyn_cast<FunctionDecl>(*i) ) {
 			   if (fdecl->getName().equals("FREE")) mFree = fdecl;
@@ -171,154 +521,202 @@ public:
 			   else if (fdecl->getName().equals("PRINT")) mOutput = fdecl;
 			   else if (fdecl->getName().equals("main")) mEntry = fdecl;
 		   }
-		   else {
-			   if(VarDecl *vardecl = dyn_cast<VarDecl>(*i))
-			   {
-				   // global var
-				   if(vardecl->getType().getTypePtr()->isIntegerType() || 
-						   vardecl->getType().getTypePtr()->isCharType() || 
-						   vardecl->getType().getTypePtr()->isPointerType())
-				   {
-					   if(vardecl->hasInit())
-							mStack.back().bindDecl(vardecl, getExpr(vardecl->getInit()));
-					   else
-							mStack.back().bindDecl(vardecl, 0);    
-				   }
-			   }
+		   else if (VarDecl *vardecl = dyn_cast<VarDecl>(*i)) {
+			   if (auto carray = dyn_cast<ConstantArrayType>(vardecl->getType().getTypePtr()))
+				   arrayBytes += arrayStorage(carray);
 		   }
 	   }
-	   mStack.push_back(StackFrame());
+
+	   mCalls.addBuiltin(mInput, Call_Get);
+	   mCalls.addBuiltin(mOutput, Call_Print);
+	   mCalls.addBuiltin(mMalloc, Call_Malloc);
+	   mCalls.addBuiltin(mFree, Call_Free);
+	   /// hoisting adds frame slots, the call sites copy the final sizes
+	   mNodes.build(unit, mLayout);
+	   mCalls.build(unit, mLayout, mNodes);
+
+	   // global vars
+	   mData.layout(mLayout.getNumGlobals(), arrayBytes);
+	   size_t offset = 0;
+	   for (Decl * decl : unit->decls()) {
+		   VarDecl *vardecl = dyn_cast<VarDecl>(decl);
+		   if (!vardecl)
+			   continue;
+		   unsigned idx = mLayout.getSlot(vardecl).index;
+		   const Type * type = vardecl->getType().getTypePtr();
+		   if (auto carray = dyn_cast<ConstantArrayType>(type)) {
+			   int64_t addr = mData.arrayAddress(offset);
+			   offset += arrayStorage(carray);
+			   mData.set(idx, addr);
+			   if (vardecl->hasInit())
+				   initArray(vardecl->getInit(), carray, addr);
+		   } else if (type->isIntegerType() || type->isCharType() || type->isPointerType()) {
+			   if (vardecl->hasInit())
+				   mData.set(idx, constantValue(vardecl->getInit()));
+		   }
+	   }
+	   pushStack(mEntry);
    }
 
    FunctionDecl * getEntry() {
 	   return mEntry;
    }
+   FunctionDecl * getInput() {
+	   return mInput;
+   }
+   FunctionDecl * getOutput() {
+	   return mOutput;
+   }
+   FunctionDecl * getMalloc() {
+	   return mMalloc;
+   }
+   FunctionDecl * getFree() {
+	   return mFree;
+   }
 
-   /// !TODO Support comparison operation
-   void binop(BinaryOperator *bop) {
-	   Expr * left = bop->getLHS();
-	   Expr * right = bop->getRHS();
+   /// Built-in services, shared by every execution engine
+   int64_t input() {
+	   int64_t val = 0;
+	   llvm::errs() << "Please Input an Integer Value : ";
+	   scanf("%ld", &val);
+	   return val;
+   }
+   void output(int64_t val) {
+	   llvm::errs() << val << "\n";
+   }
+   int64_t allocate(int64_t size) {
+	   return mHeap.Malloc(size);
+   }
+   void deallocate(int64_t addr) {
+	   mHeap.Free(addr);
+   }
 
+   /// Operands of the expression being evaluated
+   void pushOperand(int64_t val) {
+	   mOperands.push(val);
+   }
+   int64_t popOperand() {
+	   return mOperands.pop();
+   }
+   size_t getOperandDepth() {
+	   return mOperands.size();
+   }
+   /// The n topmost operands, oldest first
+   int64_t * topOperands(unsigned n) {
+	   return mOperands.top(n);
+   }
+   void dropOperands(unsigned n) {
+	   mOperands.drop(n);
+   }
+
+   /// A folded node pushes its value, its operands must not be evaluated
+   bool folded(const NodeInfo & node) {
+	   if (node.handler != Node_Constant)
+		   return false;
+	   mOperands.push(node.value);
+	   return true;
+   }
+   /// Inside its loop a hoisted node pushes the value computed before the
+   /// loop started
+   bool hoisted(const NodeInfo & node) {
+	   if (!node.hoisted)
+		   return false;
+	   mOperands.push(mStack.back().getDeclVal(node.slot.index));
+	   return true;
+   }
+
+   void binop(BinaryOperator *bop) {
+	   binop(bop, mNodes.lookup(bop));
+   }
+   /// !TODO Support comparison operation
+   void binop(BinaryOperator *bop, const NodeInfo & node) {
 	   if (bop->isAssignmentOp()) {
-		   if (DeclRefExpr * declexpr = dyn_cast<DeclRefExpr>(left)) {
-			   int64_t val = mStack.back().getStmtVal(right);
-			   mStack.back().bindStmt(left, val);
-			   Decl * decl = declexpr->getFoundDecl();
-			   mStack.back().bindDecl(decl, val);
-		   } else if (auto arrayse = dyn_cast<ArraySubscriptExpr>(left)) {
-			   if(auto drf = dyn_cast<DeclRefExpr>(arrayse->getLHS()->IgnoreImpCasts()))
-			   {
-				   Decl * decl = drf->getFoundDecl();
-				   if(VarDecl * vardecl = dyn_cast<VarDecl>(decl))
-				   {
-					   if(auto array = dyn_cast<ConstantArrayType>(vardecl->getType().getTypePtr()))
-					   {
-						   void * ptr = (void *)mStack.back().getStmtVal(arrayse->getBase());
-						   int idx = mStack.back().getStmtVal(arrayse->getIdx());
-						   int64_t val = mStack.back().getStmtVal(right);
-						   printf("%p: %d %ld\n", ptr, idx, val);
-						   if (array->getElementType().getTypePtr()->isIntegerType())
-							   *((int64_t *)ptr+idx) = val;
-						   else if (array->getElementType().getTypePtr()->isCharType())
-							   *((char *)ptr+idx) = (char)val;
-						   else
-							   *((int64_t *)ptr+idx) = val;
-					   }
-					   else {
-						   /* char *a;
-							* a = (char*)malloc(2*sizeof(char));
-							* a[0] = 1;
-							* a[1] = 2;
-							* */
-						   // TODO: find the above case belonging to which type
-						   void * ptr = (void *)mStack.back().getStmtVal(arrayse->getBase());
-						   int idx = mStack.back().getStmtVal(arrayse->getIdx());
-						   int64_t val = mStack.back().getStmtVal(right);
-						   printf("%p: %d %ld\n", ptr, idx, val);
-						   *((int64_t *)ptr+idx) = val;
-					   }
-					   /*
-					   if(vardecl->getType()->isIntegerType())
-						   puts("int");
-					   else if(vardecl->getType()->isCharType())
-						   puts("char");
-					   else if(vardecl->getType()->isPointerType())
-						   puts("pointer");
-					   else 
-						   puts("unkown");
-						*/
-				   }
-			   }
-		   } else if (auto unaryop = dyn_cast<UnaryOperator>(left)) {
-			   int64_t ptr = mStack.back().getStmtVal(unaryop->getSubExpr());
-			   int64_t val = mStack.back().getStmtVal(right);
-			   *(int64_t *)ptr = val;
-		   } else {
+		   int64_t val = mOperands.pop();
+		   switch (node.handler) {
+			   case Node_StoreVar:
+				   bindSlot(node.slot, val);
+				   break;
+			   case Node_Store8:
+				   storeElement<1>(val);
+				   break;
+			   case Node_Store64:
+				   storeElement<8>(val);
+				   break;
+			   case Node_StoreDeref:
+				   if (node.width == 1)
+					   Heap::store8(mOperands.pop(), val);
+				   else
+					   Heap::store64(mOperands.pop(), val);
+				   break;
+			   default:
+				   llvm::errs() << "can not assign to this Expr\n";
+				   exit(0);
 		   }
+		   mOperands.push(val);
 	   }
 	   // add op 
 	   else {
 			int64_t op = bop->getOpcode();
+			int64_t rval = mOperands.pop();
+			int64_t lval = mOperands.pop();
 			int64_t result = 0;
 			
 			switch(op)
 			{
 				// + - * / < > == default
 				case BO_Add:
-					if(left->getType().getTypePtr()->isPointerType())
-					{
-						int64_t ptr = mStack.back().getStmtVal(left);
-						result = ptr + 8 * getExpr(right);
-					}
-					else 
-						result = getExpr(left) + getExpr(right);
+					if(node.handler == Node_AddPointer && node.width == 1)
+						result = add<1>(lval, rval);
+					else if(node.handler == Node_AddPointer)
+						result = add<8>(lval, rval);
+					else
+						result = add<1>(lval, rval);
 					break;
 				case BO_Sub:
-						result = getExpr(left) - getExpr(right);
+						result = lval - rval;
 					break;
 				case BO_Mul:
-					result = getExpr(left) * getExpr(right);
+					result = lval * rval;
 					break;
 				case BO_Div:
-					if(getExpr(right) == 0)
+					if(rval == 0)
 					{
 						llvm::errs() << "div 0 errs\n";
 						exit(0);
 					}
-					result = getExpr(left) / getExpr(right);
+					result = lval / rval;
 					break;
 				case BO_LT:
-					result = getExpr(left) < getExpr(right);
+					result = lval < rval;
 					break;
 				case BO_GT:
-					result = getExpr(left) > getExpr(right);
+					result = lval > rval;
 					break;
 				case BO_EQ:
-					result = getExpr(left)==getExpr(right);
+					result = lval == rval;
 					break;
 				default:
 					llvm::errs() << "can not process this Op\n";
 					exit(0);
 					break;
 			}
-			// if(mStack.back().exprExits(bop))
-			mStack.back().bindStmt(bop, result);
+			mOperands.push(result);
 	   }
    }
 
    void unaryop(UnaryOperator * uop) {
-	   Expr* expr = uop->getSubExpr();
 	   switch(uop->getOpcode())
 	   {
 		   case UO_Minus:
-			   mStack.back().bindStmt(uop, -1*(getExpr(expr)));
+			   mOperands.push(-1*mOperands.pop());
 			   break;
 		   case UO_Plus:
-			   mStack.back().bindStmt(uop, getExpr(expr));
 			   break;
 		   case UO_Deref:
-			   mStack.back().bindStmt(uop, *(int64_t*)getExpr(expr));
-			   // mStack.back().bindStmt(uop, *(int64_t*)mStack.back().getStmtVal(expr));
+			   if(mNodes.lookup(uop).width == 1)
+				   mOperands.push(Heap::load8(mOperands.pop()));
+			   else
+				   mOperands.push(Heap::load64(mOperands.pop()));
 			   break;
 		   default:
 			   llvm::errs() << "can not process this UOp\n";
@@ -327,191 +725,260 @@ public:
 	   }
    }
 
-   void decl(DeclStmt * declstmt) {
-	   for (DeclStmt::decl_iterator it = declstmt->decl_begin(), ie = declstmt->decl_end();
-			   it != ie; ++ it) {
-		   Decl * decl = *it;
-		   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl)) {
-			   if(vardecl->getType().getTypePtr()->isIntegerType() || 
-					   vardecl->getType().getTypePtr()->isCharType() || 
-					   vardecl->getType().getTypePtr()->isPointerType()) {
-				   if(vardecl->hasInit())
-				   {
-					   // mStack.back().bindDecl(vardecl, getExpr(vardecl->getInit()));
-					   int64_t value = mStack.back().getStmtVal(vardecl->getInit());
-					   mStack.back().bindDecl(vardecl, value);
-				   }
-				   else
-					   mStack.back().bindDecl(vardecl, 0);
-			   } 
-			   else if(vardecl->getType().getTypePtr()->isConstantArrayType()) {
-				   auto carray = dyn_cast<ConstantArrayType>(vardecl->getType().getTypePtr());
-				   int64_t size = carray->getSize().getSExtValue();
-				   // QualType
-				   // the element type of the array
-				   auto element = carray->getElementType();
-				   if(element.getTypePtr()->isIntegerType()){
-					   int64_t *var_array = new int64_t[size];
-					   for(int i = 0; i < size; i++)
-						   var_array[i] = 0;
-					   mStack.back().bindDecl(vardecl, (int64_t)var_array);
-				   } else if(element.getTypePtr()->isCharType()) {
-					   char *var_array = new char[size];
-					   for(int i = 0; i < size; i++)
-						   var_array[i] = 0;
-					   mStack.back().bindDecl(vardecl, (int64_t)var_array);
-				   } else if(element.getTypePtr()->isPointerType()) {
-					   int64_t **var_array = new int64_t *[size];
-					   for(int i = 0; i < size; i++)
-						   var_array[i] = 0;
-					   mStack.back().bindDecl(vardecl, (int64_t)var_array);
-				   } else {
-					   exit(0);
-				   }
-			   }
-		   }
+   /// The initializer of a scalar, if it has one, is on the operand stack
+   void decl(VarDecl * vardecl) {
+	   const NodeInfo & node = mNodes.lookup(vardecl);
+	   switch (node.handler) {
+		   case Node_DeclScalar:
+			   bindSlot(node.slot, node.init ? mOperands.pop() : 0);
+			   break;
+		   case Node_DeclArray:
+			   bindSlot(node.slot, mRegion.allocate(node.bytes));
+			   break;
+		   case Node_Unsupported:
+			   exit(0);
+		   default:
+			   break;
 	   }
    }
    void declref(DeclRefExpr * declref) {
 	   mStack.back().setPC(declref);
-	   if (declref->getType()->isIntegerType() ||
-			   declref->getType()->isCharType() || 
-			   declref->getType()->isPointerType()) { 
-		   Decl * decl = declref->getFoundDecl();
-		   int64_t val = getStackDeclVal(decl);
-		   mStack.back().bindStmt(declref, val);
-	   } else if (declref->getType()->isArrayType()) {
-		   Decl * decl = declref->getFoundDecl();
-		   int64_t val = getStackDeclVal(decl);
-		   mStack.back().bindStmt(declref, val);
-	   } else {
+	   const NodeInfo & node = mNodes.lookup(declref);
+	   switch (node.handler) {
+		   case Node_LoadVar:
+			   mOperands.push(getSlotVal(node.slot));
+			   break;
+		   case Node_Constant:
+			   mOperands.push(node.value);
+			   break;
+		   case Node_Unsupported:
+			   llvm::errs() << "can not refer to " << declref->getDecl()->getName() << "\n";
+			   exit(0);
+		   default:
+			   mOperands.push(0);
+			   break;
 	   }
    }
 
-   void cast(CastExpr * castexpr) {
-	   mStack.back().setPC(castexpr);
-	   if (castexpr->getType()->isIntegerType()) {
-		   Expr * expr = castexpr->getSubExpr();
-		   int64_t val = mStack.back().getStmtVal(expr);
-		   mStack.back().bindStmt(castexpr, val);
-	   } else if (castexpr->getType()->isPointerType()) {
-		   if ( castexpr->getCastKind() == CK_LValueToRValue || 
-				   castexpr->getCastKind() == CK_ArrayToPointerDecay || 
-				   castexpr->getCastKind() == CK_PointerToIntegral || 
-				   castexpr->getCastKind() == CK_BitCast)
-		   {
-			   Expr * expr = castexpr->getSubExpr();
-			   int64_t val = mStack.back().getStmtVal(expr);
-			   mStack.back().bindStmt(castexpr, val);
-		   }
-	   }
-	   else { 
-	   }
+   /// The arguments of the call are on top of the operand stack. Built-ins
+   /// leave their result there. A user function gets its frame pushed with
+   /// the arguments copied into the parameter slots; the caller runs
+   /// target.body and pops the frame. An inlined function gets its arguments
+   /// copied into the caller's frame at target.inlineBase; the caller
+   /// evaluates target.inlined in place.
+   const CallTarget & call(CallExpr * callexpr) {
+	   return call(callexpr, mCalls.lookup(callexpr));
    }
-
-   /// !TODO Support Function Call
-   void call(CallExpr * callexpr) {
+   const CallTarget & call(CallExpr * callexpr, const CallTarget & target) {
 	   mStack.back().setPC(callexpr);
-	   int64_t val = 0;
-	   FunctionDecl * callee = callexpr->getDirectCallee();
-	   if (callee == mInput) {
-		   llvm::errs() << "Please Input an Integer Value : ";
-		   scanf("%ld", &val);
-		   mStack.back().bindStmt(callexpr, val);
-	   } else if (callee == mOutput) {
-		   Expr * decl = callexpr->getArg(0);
-		   val = mStack.back().getStmtVal(decl);
-		   /*if(auto array = dyn_cast<ArraySubscriptExpr>(decl->IgnoreImpCasts()))
-		   {
-			   llvm::errs() << *(int64_t*)val << "\n";
+	   switch (target.kind) {
+		   case Call_Get:
+			   mOperands.push(input());
+			   break;
+		   case Call_Print:
+			   output(mOperands.pop());
+			   mOperands.push(0);
+			   break;
+		   case Call_Malloc:
+			   mOperands.push(allocate(mOperands.pop()));
+			   break;
+		   case Call_Free:
+			   deallocate(mOperands.pop());
+			   mOperands.push(0);
+			   break;
+		   case Call_User: {
+			   if (!target.body) {
+				   llvm::errs() << "can not find the body of " << callexpr->getDirectCallee()->getName() << "\n";
+				   exit(0);
+			   }
+			   assert(callexpr->getNumArgs() == target.numParams);
+			   int64_t * args = mOperands.top(target.numParams);
+			   if (target.inlined) {
+				   memcpy(mStack.back().getVars() + target.inlineBase, args, target.numParams * sizeof(int64_t));
+				   mOperands.drop(target.numParams);
+				   break;
+			   }
+			   memcpy(pushStack(target.numSlots), args, target.numParams * sizeof(int64_t));
+			   mOperands.drop(target.numParams);
+			   break;
 		   }
-		   else {
-			   llvm::errs() << val << "\n";
-		   }*/
-		   llvm::errs() << val << "\n";
-	   } else if (callee == mMalloc) {
-		   // int64_t size = getExpr(callexpr->getArg(0));
-		   int64_t size = mStack.back().getStmtVal(callexpr->getArg(0));
-		   int64_t *ptr = (int64_t *)std::malloc(size);
-		   mStack.back().bindStmt(callexpr, (int64_t)ptr);
-	   } else if (callee == mFree) {
-		   std::free((int64_t *)getExpr(callexpr->getArg(0)));
-	   }
-	   else {
-		   std::vector<int64_t> args;
-		   for(auto item = callexpr->arg_begin(), end = callexpr->arg_end();
-				   item != end; item += 1)
-			   args.push_back(getExpr(*item));
-		   mStack.push_back(StackFrame());
-		   int64_t idx = 0;
-		   for(auto item = callee->param_begin(), end = callee->param_end();
-				   item != end; item += 1, idx += 1 )
-			   mStack.back().bindDecl(*item, args[idx]);
 	   }
+	   return target;
    }
 
    void intlt(IntegerLiteral * intlt) {
 	   // llvm::APint intlt->getValue()
-	   mStack.back().bindStmt(intlt, intlt->getValue().getSExtValue());
+	   mOperands.push(intlt->getValue().getSExtValue());
    }
 
    void chlt(CharacterLiteral * charlt) {
-	   mStack.back().bindStmt(charlt, charlt->getValue());
+	   mOperands.push(charlt->getValue());
    }
 
    void rstmt(ReturnStmt * rstmt) {
-	   int64_t value = mStack.back().getStmtVal(rstmt->getRetValue());
+	   int64_t value = 0;
+	   if (rstmt->getRetValue())
+		   value = mOperands.pop();
 	   mStack.back().setRetVal(value);
    }
 
    void arrayse(ArraySubscriptExpr * ase) {
-	   int64_t *array = (int64_t *)mStack.back().getStmtVal(ase->getBase());
-	   int idx = mStack.back().getStmtVal(ase->getIdx());
-	   mStack.back().bindStmt(ase, array[idx]);
+	   if (mNodes.lookup(ase).handler == Node_Load8)
+		   loadElement<1>();
+	   else
+		   loadElement<8>();
    }
 
-   void unaryOrtt(UnaryExprOrTypeTraitExpr * uette) {
-	   if(auto sizeofexpr = dyn_cast<UnaryExprOrTypeTraitExpr>(uette))
-	   {
-		   if (sizeofexpr->getKind() == UETT_SizeOf)
-		   {
-			   if(sizeofexpr->getArgumentType()->isIntegerType() || 
-					   sizeofexpr->getArgumentType()->isPointerType())
-				   mStack.back().bindStmt(uette, 8);
+   /// Cursors and trip count of loop, from the value its induction variable
+   /// has now. Runs before the first iteration and whenever another tier
+   /// ran iterations of the loop.
+   void startInduction(const InductionLoop & loop) {
+	   int64_t * vars = mStack.back().getVars();
+	   int64_t var = getSlotVal(loop.var);
+	   for (const Cursor & cursor : loop.cursors)
+		   vars[cursor.slot] = getSlotVal(cursor.base) + cursor.width * (var + cursor.offset);
+	   if (loop.bound) {
+		   int64_t step = loop.step > 0 ? loop.step : -loop.step;
+		   int64_t distance = loop.step > 0 ? vars[loop.limit] - var : var - vars[loop.limit];
+		   vars[loop.trips] = distance > 0 ? (distance + step - 1) / step : 0;
+	   }
+   }
+   /// Stands for the test of a counted loop
+   bool nextTrip(const InductionLoop & loop) {
+	   int64_t & trips = mStack.back().getVars()[loop.trips];
+	   if (trips == 0)
+		   return false;
+	   trips--;
+	   return true;
+   }
+   /// Follows the increment of the induction variable
+   void stepInduction(const InductionLoop & loop) {
+	   int64_t * vars = mStack.back().getVars();
+	   for (const Cursor & cursor : loop.cursors)
+		   vars[cursor.slot] += cursor.width * loop.step;
+   }
+   /// A subscript of the induction variable, neither base nor index is
+   /// evaluated
+   void loadCursor(const NodeInfo & node) {
+	   int64_t addr = mStack.back().getDeclVal(node.slot.index);
+	   if (node.handler == Node_Load8)
+		   mOperands.push(ElementAccess<1>::load(addr));
+	   else
+		   mOperands.push(ElementAccess<8>::load(addr));
+   }
+   /// An assignment to a subscript of the induction variable, the value is
+   /// on the operand stack and stays there
+   void storeCursor(const NodeInfo & node) {
+	   int64_t addr = mStack.back().getDeclVal(node.slot.index);
+	   int64_t val = *mOperands.top(1);
+	   if (node.handler == Node_Store8)
+		   ElementAccess<1>::store(addr, val);
+	   else
+		   ElementAccess<8>::store(addr, val);
+   }
+
+   /// Run the trips left of a loop whose body is an idiom as one kernel, and
+   /// leave the induction and sum variables as the loop would. value is the
+   /// invariant of a fill. False if the loop has to be walked: a copy to an
+   /// overlapping destination past its source.
+   bool runIdiom(const InductionLoop & loop, int64_t value) {
+	   if (loop.idiom == Idiom_None)
+		   return false;
+	   int64_t * vars = mStack.back().getVars();
+	   int64_t trips = vars[loop.trips];
+	   const Cursor & cursor = loop.cursors[loop.idiom == Idiom_Sum ? loop.source : loop.target];
+	   int64_t bytes = trips * cursor.width;
+	   /// counting down, the elements end at the cursor
+	   int64_t addr = vars[cursor.slot];
+	   if (loop.step < 0)
+		   addr -= bytes - cursor.width;
+	   switch (loop.idiom) {
+		   case Idiom_Fill:
+			   if (cursor.width == 1)
+				   Heap::fill8(addr, trips, value);
+			   else
+				   Heap::fill64(addr, trips, value);
+			   break;
+		   case Idiom_Copy: {
+			   int64_t source = vars[loop.cursors[loop.source].slot];
+			   if (source < addr && addr < source + bytes)
+				   return false;
+			   memmove((void *)addr, (void *)source, bytes);
+			   break;
 		   }
+		   case Idiom_Sum: {
+			   int64_t sum = cursor.width == 1 ? Heap::sum8(addr, trips) : Heap::sum64(addr, trips);
+			   bindSlot(loop.sum, (int64_t)((uint64_t)getSlotVal(loop.sum) + (uint64_t)sum));
+			   break;
+		   }
+		   default:
+			   return false;
 	   }
+	   bindSlot(loop.var, getSlotVal(loop.var) + trips * loop.step);
+	   vars[loop.trips] = 0;
+	   return true;
    }
 
-   void parene(ParenExpr * pe) {
-	   Expr * expr = pe->getSubExpr();
-	   int64_t value = mStack.back().getStmtVal(expr);
-	   mStack.back().bindStmt(pe, value);
+   void unaryOrtt(UnaryExprOrTypeTraitExpr * uette) {
+	   mOperands.push(mNodes.lookup(uette).width);
    }
 
-   int64_t getExpr(Expr* expr)
-   {
-	   expr = expr->IgnoreImpCasts();
-	   if(auto intlt = dyn_cast<IntegerLiteral>(expr))
-		   return intlt->getValue().getSExtValue();
-	   else if(auto charlt = dyn_cast<CharacterLiteral>(expr))
-		   return charlt->getValue();
-	   else if(auto declref = dyn_cast<DeclRefExpr>(expr))
-		   return getStackDeclVal(declref->getDecl());
-	   else if(auto bop = dyn_cast<BinaryOperator>(expr)) {
-		   binop(bop);
-		   return mStack.back().getStmtVal(bop);
-	   }
-	   else if(auto uop = dyn_cast<UnaryOperator>(expr)) {
-		   unaryop(uop);
-		   return mStack.back().getStmtVal(uop);
-	   }
-	   else if(auto call = dyn_cast<CallExpr>(expr))
-		   return mStack.back().getStmtVal(call);
-	   else 
-	   {
-		   return mStack.back().getStmtVal(expr);
+   /// Global initializers are constant expressions, Clang folds them for us
+   int64_t constantValue(Expr * init) {
+	   ASTContext & context = *mContext;
+	   Expr::EvalResult result;
+	   if (isa<ImplicitValueInitExpr>(init))
+		   return 0;
+	   if (init->EvaluateAsInt(result, context))
+		   return result.Val.getInt().getSExtValue();
+	   if (init->isNullPointerConstant(context, Expr::NPC_ValueDependentIsNull))
+		   return 0;
+	   llvm::errs() << "can not process this global initializer\n";
+	   exit(0);
+   }
+
+private:
+   /// Handlers the node descriptors select, one instantiation per width
+   template <unsigned Width> void loadElement() {
+	   int idx = mOperands.pop();
+	   int64_t array = mOperands.pop();
+	   mOperands.push(ElementAccess<Width>::load(array + Width * idx));
+   }
+   template <unsigned Width> void storeElement(int64_t val) {
+	   int idx = mOperands.pop();
+	   int64_t ptr = mOperands.pop();
+	   ElementAccess<Width>::store(ptr + Width * idx, val);
+   }
+   template <int64_t Scale> static int64_t add(int64_t lval, int64_t rval) {
+	   return lval + Scale * rval;
+   }
+
+   /// Bytes a global array takes in the data segment, kept 16-byte aligned
+   static size_t arrayStorage(const ConstantArrayType * carray) {
+	   size_t bytes = carray->getSize().getZExtValue() * elementWidth(carray->getElementType());
+	   return (bytes + 15) & ~(size_t)15;
+   }
+   void initArray(Expr * init, const ConstantArrayType * carray, int64_t addr) {
+	   int64_t width = elementWidth(carray->getElementType());
+	   int64_t size = carray->getSize().getSExtValue();
+	   init = init->IgnoreParens();
+	   if (InitListExpr * list = dyn_cast<InitListExpr>(init)) {
+		   for (unsigned i = 0; i < list->getNumInits() && i < size; i++) {
+			   int64_t val = constantValue(list->getInit(i));
+			   if (width == 1)
+				   Heap::store8(addr + i, val);
+			   else
+				   Heap::store64(addr + 8 * i, val);
+		   }
+	   } else if (StringLiteral * str = dyn_cast<StringLiteral>(init)) {
+		   StringRef bytes = str->getBytes();
+		   for (unsigned i = 0; i < bytes.size() && i < size; i++)
+			   Heap::store8(addr + i, bytes[i]);
+	   } else {
+		   llvm::errs() << "can not process this global initializer\n";
+		   exit(0);
 	   }
    }
 };
 
-
+#endif
@@ -0,0 +1,128 @@
+//==--- FrameLayout.h - Dense slot assignment for variables ---------------===//
+//===----------------------------------------------------------------------===//
+#ifndef _FRAMELAYOUT_H_
+#define _FRAMELAYOUT_H_
+
+#include <algorithm>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/DenseMap.h"
+
+using namespace clang;
+
+/// Slot layout of one function frame.
+/// Parameters always occupy slots 0..numParams-1.
+/// Functions are numbered densely in the order of their definitions.
+struct FunctionLayout {
+   unsigned index;
+   unsigned numParams;
+   unsigned numSlots;
+};
+
+/// Slot of a variable, in the global frame or in the frame of its function
+struct VarSlot {
+   unsigned index;
+   bool global;
+};
+
+/// Pre-pass giving every VarDecl/ParmVarDecl a dense slot index.
+/// Globals are numbered in the global frame, locals in the frame of their
+/// function, where variables of disjoint block scopes share slots.
+class FrameLayout {
+   llvm::DenseMap<const VarDecl *, VarSlot> mSlots;
+   llvm::DenseMap<const FunctionDecl *, FunctionLayout> mFunctions;
+   unsigned mNumGlobals;
+   unsigned mNumFunctions;
+
+   /// Next free slot and high-water mark of the function being laid out
+   unsigned mNext;
+   unsigned mMax;
+public:
+   FrameLayout() : mSlots(), mFunctions(), mNumGlobals(0), mNumFunctions(0), mNext(0), mMax(0) {
+   }
+
+   void build(TranslationUnitDecl * unit) {
+	   for (Decl * decl : unit->decls()) {
+		   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl)) {
+			   VarSlot slot = { mNumGlobals++, true };
+			   mSlots[vardecl] = slot;
+		   } else if (FunctionDecl * fdecl = dyn_cast<FunctionDecl>(decl)) {
+			   if (fdecl->doesThisDeclarationHaveABody())
+				   layoutFunction(fdecl);
+		   }
+	   }
+   }
+
+   unsigned getNumGlobals() {
+	   return mNumGlobals;
+   }
+   unsigned getNumFunctions() {
+	   return mNumFunctions;
+   }
+   const VarSlot & getSlot(const VarDecl * vardecl) {
+	   assert(mSlots.find(vardecl) != mSlots.end());
+	   return mSlots.find(vardecl)->second;
+   }
+   /// Layout of the frame of fdecl, any redeclaration of the definition works
+   const FunctionLayout & getFunction(const FunctionDecl * fdecl) {
+	   const FunctionDecl * def = fdecl->getDefinition();
+	   assert(def && mFunctions.find(def) != mFunctions.end());
+	   return mFunctions.find(def)->second;
+   }
+   /// A slot past the variables of fdecl, for a value the executor keeps
+   /// in the frame
+   unsigned addSlot(const FunctionDecl * fdecl) {
+	   const FunctionDecl * def = fdecl->getDefinition();
+	   assert(def && mFunctions.find(def) != mFunctions.end());
+	   return mFunctions.find(def)->second.numSlots++;
+   }
+   /// Grow the frame of fdecl to at least numSlots slots
+   void reserveSlots(const FunctionDecl * fdecl, unsigned numSlots) {
+	   const FunctionDecl * def = fdecl->getDefinition();
+	   assert(def && mFunctions.find(def) != mFunctions.end());
+	   FunctionLayout & layout = mFunctions.find(def)->second;
+	   layout.numSlots = std::max(layout.numSlots, numSlots);
+   }
+
+private:
+   void layoutFunction(FunctionDecl * fdecl) {
+	   mNext = 0;
+	   mMax = 0;
+	   for (ParmVarDecl * param : fdecl->parameters())
+		   assign(param);
+	   FunctionLayout layout;
+	   layout.index = mNumFunctions++;
+	   layout.numParams = mNext;
+	   layoutStmt(fdecl->getBody());
+	   layout.numSlots = mMax;
+	   mFunctions[fdecl] = layout;
+   }
+
+   void assign(VarDecl * vardecl) {
+	   VarSlot slot = { mNext++, false };
+	   mSlots[vardecl] = slot;
+	   if (mNext > mMax)
+		   mMax = mNext;
+   }
+
+   void layoutStmt(Stmt * stmt) {
+	   if (!stmt)
+		   return;
+	   if (DeclStmt * declstmt = dyn_cast<DeclStmt>(stmt)) {
+		   for (Decl * decl : declstmt->decls())
+			   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl))
+				   assign(vardecl);
+	   }
+	   /// A block or a for statement opens a scope, whose slots are free
+	   /// again for the statements following it
+	   bool scope = isa<CompoundStmt>(stmt) || isa<ForStmt>(stmt);
+	   unsigned saved = mNext;
+	   for (Stmt * child : stmt->children())
+		   layoutStmt(child);
+	   if (scope)
+		   mNext = saved;
+   }
+};
+
+#endif
@@ -0,0 +1,462 @@
+//==--- Jit.h - ORC JIT tier for hot guest functions ----------------------===//
+//===----------------------------------------------------------------------===//
+#ifndef _JIT_H_
+#define _JIT_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Utils.h"
+
+#include "Bytecode.h"
+#include "Environment.h"
+#include "Runtime.h"
+
+/// Lowers the straight-line bytecode instructions of one LLVM function.
+/// Every register is an alloca, which mem2reg turns into SSA values; control
+/// flow is left to the user, which knows whether it lowers a function or a
+/// trace. Guest memory and the built-ins are reached like the interpreter
+/// does, through the DataSegment and the Runtime callbacks, which JitTier
+/// binds to the rt.* symbols.
+class BcLowering {
+   llvm::Module & mModule;
+   llvm::Function * mFunction;
+   llvm::Type * mI64;
+   llvm::Type * mI8;
+   std::vector<llvm::Value *> mRegs;
+   llvm::Value * mEnvArg;
+   llvm::Value * mGlobals;
+   llvm::BasicBlock * mDivZero;
+public:
+   llvm::IRBuilder<> b;
+
+   /// Starts an entry block holding numRegs registers, all set to 0
+   BcLowering(llvm::Module & module, llvm::Function * function, Environment * env, unsigned numRegs)
+   : mModule(module), mFunction(function), mI64(llvm::Type::getInt64Ty(module.getContext())),
+	   mI8(llvm::Type::getInt8Ty(module.getContext())), mRegs(numRegs), mEnvArg(NULL), mGlobals(NULL),
+	   mDivZero(NULL), b(llvm::BasicBlock::Create(module.getContext(), "entry", function)) {
+	   mEnvArg = b.CreateIntToPtr(b.getInt64((uint64_t)env), b.getInt8PtrTy());
+	   mGlobals = b.CreateIntToPtr(b.getInt64((uint64_t)env->getDataSegment().cells()), mI64->getPointerTo());
+	   for (unsigned r = 0; r < numRegs; r++) {
+		   mRegs[r] = b.CreateAlloca(mI64);
+		   b.CreateStore(b.getInt64(0), mRegs[r]);
+	   }
+   }
+
+   llvm::BasicBlock * block(const llvm::Twine & name) {
+	   return llvm::BasicBlock::Create(mModule.getContext(), name, mFunction);
+   }
+   llvm::Value * get(int32_t reg) {
+	   return b.CreateLoad(mI64, mRegs[reg]);
+   }
+   void set(int32_t reg, llvm::Value * val) {
+	   b.CreateStore(val, mRegs[reg]);
+   }
+   llvm::Value * isZero(int32_t reg) {
+	   return b.CreateICmpEQ(get(reg), b.getInt64(0));
+   }
+   llvm::Value * envArg() {
+	   return mEnvArg;
+   }
+   llvm::FunctionCallee runtime(const char * name, llvm::Type * ret, llvm::ArrayRef<llvm::Type *> params) {
+	   return mModule.getOrInsertFunction(name, llvm::FunctionType::get(ret, params, false));
+   }
+   llvm::Value * mark() {
+	   return b.CreateCall(runtime("rt.mark", mI64, { b.getInt8PtrTy() }), { mEnvArg });
+   }
+   void release(llvm::Value * mark) {
+	   b.CreateCall(runtime("rt.release", b.getVoidTy(), { b.getInt8PtrTy(), mI64 }), { mEnvArg, mark });
+   }
+
+   /// Lower i if it neither jumps nor calls nor returns; consts is the
+   /// constant pool its operands refer to
+   bool straight(const Instr & i, const std::vector<int64_t> & consts) {
+	   using namespace llvm;
+	   Type * env = b.getInt8PtrTy();
+	   Type * voidTy = b.getVoidTy();
+	   switch (i.op) {
+		   case BC_LoadK: set(i.a, b.getInt64(consts[i.b])); break;
+		   case BC_Mov: set(i.a, get(i.b)); break;
+		   case BC_LoadG: set(i.a, b.CreateLoad(mI64, cell(i.b))); break;
+		   case BC_StoreG: b.CreateStore(get(i.b), cell(i.a)); break;
+		   case BC_Add: set(i.a, b.CreateAdd(get(i.b), get(i.c))); break;
+		   case BC_Sub: set(i.a, b.CreateSub(get(i.b), get(i.c))); break;
+		   case BC_Mul: set(i.a, b.CreateMul(get(i.b), get(i.c))); break;
+		   case BC_Div: {
+			   if (!mDivZero) {
+				   BasicBlock * here = b.GetInsertBlock();
+				   mDivZero = block("divzero");
+				   b.SetInsertPoint(mDivZero);
+				   b.CreateCall(runtime("rt.divzero", voidTy, {}));
+				   b.CreateUnreachable();
+				   b.SetInsertPoint(here);
+			   }
+			   Value * divisor = get(i.c);
+			   BasicBlock * next = block("div");
+			   b.CreateCondBr(b.CreateICmpEQ(divisor, b.getInt64(0)), mDivZero, next);
+			   b.SetInsertPoint(next);
+			   set(i.a, b.CreateSDiv(get(i.b), divisor));
+			   break;
+		   }
+		   case BC_LT: compare(CmpInst::ICMP_SLT, i); break;
+		   case BC_GT: compare(CmpInst::ICMP_SGT, i); break;
+		   case BC_EQ: compare(CmpInst::ICMP_EQ, i); break;
+		   case BC_PtrAdd: set(i.a, b.CreateAdd(get(i.b), b.CreateMul(get(i.c), b.getInt64(8)))); break;
+		   case BC_Neg: set(i.a, b.CreateNeg(get(i.b))); break;
+		   case BC_Load64: set(i.a, b.CreateLoad(mI64, ptr(get(i.b), mI64))); break;
+		   case BC_Load8: set(i.a, b.CreateSExt(b.CreateLoad(mI8, ptr(get(i.b), mI8)), mI64)); break;
+		   case BC_Store64: b.CreateStore(get(i.b), ptr(get(i.a), mI64)); break;
+		   case BC_Store8: b.CreateStore(b.CreateTrunc(get(i.b), mI8), ptr(get(i.a), mI8)); break;
+		   case BC_Index64:
+			   set(i.a, b.CreateLoad(mI64, b.CreateGEP(mI64, ptr(get(i.b), mI64), get(i.c))));
+			   break;
+		   case BC_Index8:
+			   set(i.a, b.CreateSExt(b.CreateLoad(mI8, b.CreateGEP(mI8, ptr(get(i.b), mI8), get(i.c))), mI64));
+			   break;
+		   case BC_StIndex64:
+			   b.CreateStore(get(i.c), b.CreateGEP(mI64, ptr(get(i.a), mI64), get(i.b)));
+			   break;
+		   case BC_StIndex8:
+			   b.CreateStore(b.CreateTrunc(get(i.c), mI8), b.CreateGEP(mI8, ptr(get(i.a), mI8), get(i.b)));
+			   break;
+		   case BC_Alloca:
+			   set(i.a, b.CreateCall(runtime("rt.alloca", mI64, { env, mI64 }), { mEnvArg, b.getInt64(consts[i.b]) }));
+			   break;
+		   case BC_Mark: set(i.a, mark()); break;
+		   case BC_Release: release(get(i.a)); break;
+		   case BC_Get: set(i.a, b.CreateCall(runtime("rt.get", mI64, { env }), { mEnvArg })); break;
+		   case BC_Print: b.CreateCall(runtime("rt.print", voidTy, { env, mI64 }), { mEnvArg, get(i.a) }); break;
+		   case BC_Malloc:
+			   set(i.a, b.CreateCall(runtime("rt.malloc", mI64, { env, mI64 }), { mEnvArg, get(i.b) }));
+			   break;
+		   case BC_Free: b.CreateCall(runtime("rt.free", voidTy, { env, mI64 }), { mEnvArg, get(i.a) }); break;
+		   default:
+			   return false;
+	   }
+	   return true;
+   }
+
+private:
+   llvm::Value * ptr(llvm::Value * addr, llvm::Type * type) {
+	   return b.CreateIntToPtr(addr, type->getPointerTo());
+   }
+   llvm::Value * cell(int32_t idx) {
+	   return b.CreateGEP(mI64, mGlobals, b.getInt64(idx));
+   }
+   void compare(llvm::CmpInst::Predicate pred, const Instr & i) {
+	   set(i.a, b.CreateZExt(b.CreateICmp(pred, get(i.b), get(i.c)), mI64));
+   }
+};
+
+/// Second tier of the tree walker. Every user function has a heat counter,
+/// bumped by its calls and by the loop iterations run in its body. A call to
+/// a function whose heat reaches the threshold compiles it, together with
+/// the functions it reaches, from its bytecode to LLVM IR with ORC LLJIT.
+/// From then on its calls jump straight to the native code.
+///
+/// Native code uses the same guest memory as the interpreter: globals in the
+/// DataSegment, local arrays in the StackRegion, and the built-ins through
+/// the Environment services. A function that fails to compile stays
+/// interpreted. The trace tier compiles its traces through the same LLJIT.
+class JitTier {
+   typedef int64_t (*NativeEntry)(int64_t * args);
+   struct Profile {
+	   unsigned heat;
+	   bool failed;
+	   NativeEntry entry;
+   };
+
+   Environment * mEnv;
+   TranslationUnitDecl * mUnit;
+   unsigned mThreshold;
+   std::vector<Profile> mProfiles;
+   /// Built on the first compilation only, short runs never pay for it
+   std::unique_ptr<BytecodeCompiler> mCompiler;
+   BcModule * mModule;
+   std::unique_ptr<llvm::orc::LLJIT> mJit;
+   /// Native code reports a stack overflow below this host stack address
+   uintptr_t mStackLimit;
+public:
+   /// threshold 0 keeps every function interpreted
+   JitTier(Environment * env, TranslationUnitDecl * unit, unsigned threshold)
+   : mEnv(env), mUnit(unit), mThreshold(threshold), mProfiles(), mCompiler(), mModule(NULL), mJit(), mStackLimit(0) {
+	   Profile cold = { 0, false, NULL };
+	   mProfiles.assign(env->getLayout().getNumFunctions(), cold);
+	   mStackLimit = Runtime::stackLimit();
+   }
+
+   /// A loop of the function index went round once more
+   void tick(unsigned index) {
+	   mProfiles[index].heat++;
+   }
+
+   /// Run a call on the native tier if target is, or just became, hot.
+   /// The arguments are on the operand stack; on success they are replaced
+   /// by the result, otherwise the caller interprets the call.
+   bool invoke(const CallTarget & target) {
+	   Profile & profile = mProfiles[target.index];
+	   if (!profile.entry) {
+		   if (!mThreshold || profile.failed || ++profile.heat < mThreshold)
+			   return false;
+		   if (!compile(target.index))
+			   return false;
+	   }
+	   int64_t val = profile.entry(mEnv->topOperands(target.numParams));
+	   mEnv->dropOperands(target.numParams);
+	   mEnv->pushOperand(val);
+	   return true;
+   }
+
+   /// The bytecode of the unit, NULL if LLJIT is not available
+   BcModule * getModule() {
+	   if (!mModule)
+		   start();
+	   return mModule;
+   }
+   Environment * getEnv() {
+	   return mEnv;
+   }
+   /// Optimize module, hand it to LLJIT and resolve name in it
+   void * add(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context,
+		   const std::string & name) {
+	   bool broken = llvm::verifyModule(*module, &llvm::errs());
+	   assert(!broken && "lowered an invalid module");
+	   if (broken)
+		   return NULL;
+	   module->setDataLayout(mJit->getDataLayout());
+	   optimize(*module);
+	   if (llvm::Error err = mJit->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)))) {
+		   llvm::consumeError(std::move(err));
+		   return NULL;
+	   }
+	   return lookup(name);
+   }
+   void * lookup(const std::string & name) {
+	   auto symbol = mJit->lookup(name);
+	   if (!symbol) {
+		   llvm::consumeError(symbol.takeError());
+		   return NULL;
+	   }
+	   return (void *)symbol->getAddress();
+   }
+
+private:
+   /// Set up LLJIT and the bytecode of the unit; retried by the next hot
+   /// function if it fails
+   bool start() {
+	   llvm::InitializeNativeTarget();
+	   llvm::InitializeNativeTargetAsmPrinter();
+	   auto jit = llvm::orc::LLJITBuilder().create();
+	   if (!jit) {
+		   llvm::consumeError(jit.takeError());
+		   return false;
+	   }
+	   mJit = std::move(*jit);
+	   llvm::orc::SymbolMap symbols;
+	   define(symbols, "rt.get", (void *)&Runtime::get);
+	   define(symbols, "rt.print", (void *)&Runtime::print);
+	   define(symbols, "rt.malloc", (void *)&Runtime::malloc);
+	   define(symbols, "rt.free", (void *)&Runtime::free);
+	   define(symbols, "rt.alloca", (void *)&Runtime::stackAllocate);
+	   define(symbols, "rt.mark", (void *)&Runtime::mark);
+	   define(symbols, "rt.release", (void *)&Runtime::release);
+	   define(symbols, "rt.divzero", (void *)&Runtime::divZero);
+	   define(symbols, "rt.overflow", (void *)&Runtime::overflow);
+	   if (llvm::Error err = mJit->getMainJITDylib().define(llvm::orc::absoluteSymbols(symbols))) {
+		   llvm::consumeError(std::move(err));
+		   return false;
+	   }
+	   mCompiler.reset(new BytecodeCompiler(mEnv));
+	   mModule = &mCompiler->compile(mUnit);
+	   return true;
+   }
+   void define(llvm::orc::SymbolMap & symbols, const char * name, void * addr) {
+	   symbols[mJit->mangleAndIntern(name)] = llvm::JITEvaluatedSymbol(
+			   llvm::pointerToJITTargetAddress(addr), llvm::JITSymbolFlags::Exported);
+   }
+
+   static std::string symbol(unsigned index) {
+	   return "g" + std::to_string(index);
+   }
+
+   /// Compile index and every function it reaches that is not native yet
+   /// into one module; functions of earlier modules are linked by name.
+   bool compile(unsigned index) {
+	   if (!getModule()) {
+		   mProfiles[index].failed = true;
+		   return false;
+	   }
+	   std::vector<unsigned> pending;
+	   std::vector<bool> seen(mProfiles.size(), false);
+	   std::vector<unsigned> work(1, index);
+	   while (!work.empty()) {
+		   unsigned fn = work.back();
+		   work.pop_back();
+		   if (seen[fn] || mProfiles[fn].entry)
+			   continue;
+		   seen[fn] = true;
+		   pending.push_back(fn);
+		   for (const Instr & instr : mModule->functions[fn].code)
+			   if (instr.op == BC_Call)
+				   work.push_back(instr.b);
+	   }
+
+	   std::unique_ptr<llvm::LLVMContext> context(new llvm::LLVMContext());
+	   std::unique_ptr<llvm::Module> module(new llvm::Module("guest", *context));
+	   for (unsigned fn : pending)
+		   lower(*module, fn);
+	   bool added = add(std::move(module), std::move(context), symbol(index) + ".entry") != NULL;
+	   for (unsigned fn : pending) {
+		   mProfiles[fn].entry = added ? (NativeEntry)lookup(symbol(fn) + ".entry") : NULL;
+		   mProfiles[fn].failed = !mProfiles[fn].entry;
+	   }
+	   return mProfiles[index].entry != NULL;
+   }
+
+   void optimize(llvm::Module & module) {
+	   llvm::legacy::FunctionPassManager passes(&module);
+	   passes.add(llvm::createPromoteMemoryToRegisterPass());
+	   passes.add(llvm::createInstructionCombiningPass());
+	   passes.add(llvm::createReassociatePass());
+	   passes.add(llvm::createGVNPass());
+	   passes.add(llvm::createCFGSimplificationPass());
+	   passes.doInitialization();
+	   for (llvm::Function & function : module)
+		   passes.run(function);
+	   passes.doFinalization();
+   }
+
+   /// g<index>(i64 param, ...) -> i64
+   llvm::Function * declare(llvm::Module & module, unsigned index) {
+	   if (llvm::Function * function = module.getFunction(symbol(index)))
+		   return function;
+	   llvm::Type * i64 = llvm::Type::getInt64Ty(module.getContext());
+	   std::vector<llvm::Type *> params(mModule->functions[index].numParams, i64);
+	   return llvm::Function::Create(llvm::FunctionType::get(i64, params, false),
+			   llvm::Function::ExternalLinkage, symbol(index), module);
+   }
+
+   /// Whether the call at pc is returned as is: a Ret of its value follows
+   /// that no jump lands on, and fn has no local array the callee could be
+   /// handed, so nothing of its frame is left to release. Such a call is
+   /// musttail when the prototypes match, which LLVM then always lowers to
+   /// a jump, and tail otherwise.
+   static bool tailCall(const BcFunction & fn, unsigned pc, const std::map<unsigned, llvm::BasicBlock *> & blocks) {
+	   if (pc + 1 >= fn.code.size() || blocks.count(pc + 1))
+		   return false;
+	   const Instr & ret = fn.code[pc + 1];
+	   if (ret.op != BC_Ret || ret.a != fn.code[pc].a)
+		   return false;
+	   for (const Instr & instr : fn.code)
+		   if (instr.op == BC_Alloca)
+			   return false;
+	   return true;
+   }
+
+   /// Translate the bytecode of index instruction by instruction, with a
+   /// basic block at every jump target
+   void lower(llvm::Module & module, unsigned index) {
+	   using namespace llvm;
+	   const BcFunction & fn = mModule->functions[index];
+	   Function * function = declare(module, index);
+	   BcLowering lowering(module, function, mEnv, fn.numRegs);
+	   IRBuilder<> & b = lowering.b;
+	   Type * i64 = b.getInt64Ty();
+	   unsigned r = 0;
+	   for (Argument & arg : function->args())
+		   lowering.set(r++, &arg);
+
+	   // guest recursion on the host stack ends with the interpreter's error
+	   BasicBlock * overflow = lowering.block("overflow");
+	   BasicBlock * body = lowering.block("body");
+	   Value * sp = b.CreatePtrToInt(b.CreateCall(Intrinsic::getDeclaration(&module, Intrinsic::stacksave)), i64);
+	   b.CreateCondBr(b.CreateICmpULT(sp, b.getInt64(mStackLimit)), overflow, body);
+	   b.SetInsertPoint(overflow);
+	   b.CreateCall(lowering.runtime("rt.overflow", b.getVoidTy(), {}));
+	   b.CreateUnreachable();
+	   b.SetInsertPoint(body);
+	   Value * mark = lowering.mark();
+
+	   // a block starts at every jump target and after every jump or return
+	   std::map<unsigned, BasicBlock *> blocks;
+	   blocks[0] = NULL;
+	   for (unsigned pc = 0; pc < fn.code.size(); pc++) {
+		   Opcode op = fn.code[pc].op;
+		   if (op == BC_Jmp || op == BC_Jz)
+			   blocks[fn.code[pc].b] = NULL;
+		   if ((op == BC_Jmp || op == BC_Jz || op == BC_Ret || op == BC_RetVoid) && pc + 1 < fn.code.size())
+			   blocks[pc + 1] = NULL;
+	   }
+	   for (auto & block : blocks)
+		   block.second = lowering.block("pc" + std::to_string(block.first));
+	   b.CreateBr(blocks[0]);
+
+	   for (unsigned pc = 0; pc < fn.code.size(); pc++) {
+		   auto block = blocks.find(pc);
+		   if (block != blocks.end()) {
+			   if (!b.GetInsertBlock()->getTerminator())
+				   b.CreateBr(block->second);
+			   b.SetInsertPoint(block->second);
+		   }
+		   const Instr & i = fn.code[pc];
+		   if (lowering.straight(i, fn.consts))
+			   continue;
+		   switch (i.op) {
+			   case BC_Jmp:
+				   b.CreateBr(blocks[i.b]);
+				   break;
+			   case BC_Jz:
+				   b.CreateCondBr(lowering.isZero(i.a), blocks[i.b], blocks[pc + 1]);
+				   break;
+			   case BC_Call: {
+				   std::vector<Value *> args;
+				   for (unsigned arg = 0; arg < mModule->functions[i.b].numParams; arg++)
+					   args.push_back(lowering.get(i.c + arg));
+				   CallInst * call = b.CreateCall(declare(module, i.b), args);
+				   if (tailCall(fn, pc, blocks)) {
+					   // guest tail recursion runs in constant host stack too
+					   call->setTailCallKind(fn.numParams == mModule->functions[i.b].numParams ?
+							   CallInst::TCK_MustTail : CallInst::TCK_Tail);
+					   b.CreateRet(call);
+					   pc++;
+					   break;
+				   }
+				   lowering.set(i.a, call);
+				   break;
+			   }
+			   case BC_Ret:
+			   case BC_RetVoid: {
+				   Value * val = i.op == BC_Ret ? lowering.get(i.a) : b.getInt64(0);
+				   lowering.release(mark);
+				   b.CreateRet(val);
+				   break;
+			   }
+			   default:
+				   assert(false && "unknown opcode");
+		   }
+	   }
+
+	   // g<index>.entry(i64 * args) unpacks the operand stack for the interpreter
+	   Function * entry = Function::Create(FunctionType::get(i64, { i64->getPointerTo() }, false),
+			   Function::ExternalLinkage, symbol(index) + ".entry", module);
+	   b.SetInsertPoint(BasicBlock::Create(module.getContext(), "entry", entry));
+	   std::vector<Value *> args;
+	   for (unsigned arg = 0; arg < fn.numParams; arg++)
+		   args.push_back(b.CreateLoad(i64, b.CreateGEP(i64, &*entry->arg_begin(), b.getInt64(arg))));
+	   b.CreateRet(b.CreateCall(function, args));
+   }
+};
+
+#endif
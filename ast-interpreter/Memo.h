@@ -0,0 +1,181 @@
+//==--- Memo.h - Result caches of pure guest functions --------------------===//
+//===----------------------------------------------------------------------===//
+#ifndef _MEMO_H_
+#define _MEMO_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Environment.h"
+
+/// Memoization tier of the tree walker. A user function is pure when it
+/// takes at most MaxParams integers and returns an integer, touches no
+/// memory (no dereference, subscript or pointer value), reads and writes
+/// no global but const ones, and calls only pure functions: no built-in is
+/// reachable from it. Its result then only depends on its arguments.
+///
+/// Each pure function gets a direct-mapped cache of a fixed number of
+/// entries from its arguments to its result; a new result replaces the
+/// one in its entry. Hits and misses are counted per function.
+class MemoTable {
+public:
+   static constexpr unsigned MaxParams = 4;
+
+private:
+   struct Entry {
+	   bool used;
+	   int64_t args[MaxParams];
+	   int64_t result;
+   };
+   struct FunctionMemo {
+	   FunctionDecl * def;
+	   /// Empty if the function is not pure
+	   std::vector<Entry> entries;
+	   uint64_t hits;
+	   uint64_t misses;
+   };
+
+   Environment * mEnv;
+   /// Indexed by FunctionLayout::index
+   std::vector<FunctionMemo> mFunctions;
+   /// Entries of every cache, a power of two
+   size_t mSize;
+public:
+   MemoTable(Environment * env, TranslationUnitDecl * unit, unsigned entries)
+   : mEnv(env), mFunctions(env->getLayout().getNumFunctions()), mSize(1) {
+	   while (mSize < entries)
+		   mSize <<= 1;
+	   llvm::SmallPtrSet<FunctionDecl *, 16> pure;
+	   for (Decl * decl : unit->decls())
+		   if (FunctionDecl * fdecl = dyn_cast<FunctionDecl>(decl))
+			   if (fdecl->doesThisDeclarationHaveABody()) {
+				   FunctionMemo & memo = mFunctions[mEnv->getLayout().getFunction(fdecl).index];
+				   memo.def = fdecl;
+				   memo.hits = 0;
+				   memo.misses = 0;
+				   if (pureSignature(fdecl) && pureStmt(fdecl->getBody()))
+					   pure.insert(fdecl);
+			   }
+	   /// Drop the functions calling one that is not pure until none is left,
+	   /// recursive functions stay pure if nothing else rules them out
+	   for (bool changed = true; changed;) {
+		   changed = false;
+		   for (FunctionMemo & memo : mFunctions)
+			   if (pure.count(memo.def) && !pureCalls(memo.def->getBody(), pure)) {
+				   pure.erase(memo.def);
+				   changed = true;
+			   }
+	   }
+	   for (FunctionMemo & memo : mFunctions)
+		   if (pure.count(memo.def))
+			   memo.entries.assign(mSize, Entry());
+   }
+
+   bool pure(const CallTarget & target) {
+	   return target.kind == Call_User && target.def && !mFunctions[target.index].entries.empty();
+   }
+
+   /// The result memoized for args, counting a hit or a miss
+   bool find(const CallTarget & target, const int64_t * args, int64_t & result) {
+	   FunctionMemo & memo = mFunctions[target.index];
+	   Entry & entry = memo.entries[slot(target, args)];
+	   if (entry.used && std::equal(args, args + target.numParams, entry.args)) {
+		   memo.hits++;
+		   result = entry.result;
+		   return true;
+	   }
+	   memo.misses++;
+	   return false;
+   }
+   void insert(const CallTarget & target, const int64_t * args, int64_t result) {
+	   Entry & entry = mFunctions[target.index].entries[slot(target, args)];
+	   entry.used = true;
+	   std::copy(args, args + target.numParams, entry.args);
+	   entry.result = result;
+   }
+
+   /// One line per pure function that was called
+   void report(llvm::raw_ostream & os) {
+	   for (const FunctionMemo & memo : mFunctions)
+		   if (!memo.entries.empty() && (memo.hits || memo.misses))
+			   os << "memo " << memo.def->getName() << ": " << memo.hits << " hits, "
+				   << memo.misses << " misses\n";
+   }
+
+private:
+   size_t slot(const CallTarget & target, const int64_t * args) {
+	   uint64_t hash = target.index;
+	   for (unsigned i = 0; i < target.numParams; i++)
+		   hash = (hash ^ (uint64_t)args[i]) * 0x9e3779b97f4a7c15ULL;
+	   return (hash >> 32) & (mSize - 1);
+   }
+
+   static bool pureSignature(FunctionDecl * fdecl) {
+	   if (fdecl->isMain() || fdecl->getNumParams() > MaxParams || !fdecl->getReturnType()->isIntegerType())
+		   return false;
+	   for (ParmVarDecl * param : fdecl->parameters())
+		   if (!param->getType()->isIntegerType())
+			   return false;
+	   return true;
+   }
+
+   /// Everything but the calls to user functions, which pureCalls checks
+   bool pureStmt(Stmt * stmt) {
+	   if (!stmt)
+		   return true;
+	   if (DeclStmt * declstmt = dyn_cast<DeclStmt>(stmt)) {
+		   for (Decl * decl : declstmt->decls())
+			   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl))
+				   if (!vardecl->getType()->isIntegerType())
+					   return false;
+	   } else if (Expr * expr = dyn_cast<Expr>(stmt)) {
+		   if (expr->getType()->isPointerType() || expr->getType()->isArrayType())
+			   return false;
+		   if (isa<ArraySubscriptExpr>(expr))
+			   return false;
+		   if (UnaryOperator * uop = dyn_cast<UnaryOperator>(expr))
+			   if (uop->getOpcode() == UO_Deref)
+				   return false;
+		   if (DeclRefExpr * declref = dyn_cast<DeclRefExpr>(expr))
+			   if (VarDecl * vardecl = dyn_cast<VarDecl>(declref->getDecl()))
+				   if (vardecl->hasGlobalStorage() && mEnv->getNodes().lookup(declref).handler != Node_Constant)
+					   return false;
+		   /// the callee decays to a function pointer, only the arguments count
+		   if (CallExpr * call = dyn_cast<CallExpr>(expr)) {
+			   if (mEnv->getCalls().lookup(call).kind != Call_User)
+				   return false;
+			   for (Expr * arg : call->arguments())
+				   if (!pureStmt(arg))
+					   return false;
+			   return true;
+		   }
+	   }
+	   for (Stmt * child : stmt->children())
+		   if (!pureStmt(child))
+			   return false;
+	   return true;
+   }
+
+   bool pureCalls(Stmt * stmt, const llvm::SmallPtrSet<FunctionDecl *, 16> & pure) {
+	   if (!stmt)
+		   return true;
+	   if (CallExpr * call = dyn_cast<CallExpr>(stmt)) {
+		   const CallTarget & target = mEnv->getCalls().lookup(call);
+		   if (!target.def || !pure.count(target.def))
+			   return false;
+	   }
+	   for (Stmt * child : stmt->children())
+		   if (!pureCalls(child, pure))
+			   return false;
+	   return true;
+   }
+};
+
+#endif
@@ -0,0 +1,845 @@
+//==--- NodeTable.h - Execution descriptors of the AST nodes --------------===//
+//===----------------------------------------------------------------------===//
+#ifndef _NODETABLE_H_
+#define _NODETABLE_H_
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+
+#include "FrameLayout.h"
+
+using namespace clang;
+
+/// Handler the executor runs for a node, chosen from its type ahead of
+/// execution. Widths and scales are part of the handler, each one runs a
+/// template instantiated for them.
+enum NodeHandler : uint8_t {
+   /// Pushes 0 (a DeclRefExpr to a function) or does nothing (a VarDecl)
+   Node_Ignore,
+   /// Fails when executed, the pre-pass does not reject code never run
+   Node_Unsupported,
+   Node_LoadVar,
+   Node_StoreVar,
+   Node_Load8,
+   Node_Load64,
+   Node_Store8,
+   Node_Store64,
+   Node_StoreDeref,
+   Node_AddInteger,
+   Node_AddPointer,
+   /// Any other operator, evaluated by its opcode
+   Node_Operator,
+   Node_SizeOf,
+   /// Folded ahead of execution, its operands are never evaluated
+   Node_Constant,
+   Node_Block,
+   Node_DeclScalar,
+   Node_DeclArray
+};
+
+/// What the value of a node is
+enum ValueKind : uint8_t {
+   Value_None,
+   Value_Integer,
+   Value_Pointer,
+   Value_Array
+};
+
+/// Compact descriptor of a DeclRefExpr, an operator, an ArraySubscriptExpr,
+/// a sizeof, a block or a local VarDecl
+struct NodeInfo {
+   NodeHandler handler;
+   ValueKind kind;
+   /// Bytes of an element for arrays, pointers, subscripts and the value
+   /// a dereference loads or stores, which is also the scale of the integer operand of a pointer add, of the
+   /// operand for sizeof
+   uint8_t width;
+   /// Whether a scalar VarDecl has an initializer to pop
+   bool init;
+   /// Whether an operator is computed once before the loop it is invariant
+   /// in, into the frame slot in slot
+   bool hoisted;
+   /// Whether a subscript, or an assignment to one, of the induction
+   /// variable of its loop goes through the pointer kept in slot
+   bool cursor;
+   /// Variable read, written or declared
+   VarSlot slot;
+   /// Bytes a local array takes in the stack region
+   int64_t bytes;
+   /// Value of a Node_Constant
+   int64_t value;
+   /// Statements of a block up to and including the first one that always
+   /// leaves it, the rest can not be reached
+   unsigned live;
+};
+
+/// Pointer to element base[var + offset], width bytes wide, kept in slot
+/// while var is the induction variable of a loop
+struct Cursor {
+   VarSlot base;
+   int64_t offset;
+   int64_t width;
+   unsigned slot;
+};
+
+/// Counted loop whose body a single kernel call can stand for
+enum LoopIdiom : uint8_t {
+   Idiom_None,
+   /// target[var] = value, with value invariant
+   Idiom_Fill,
+   /// target[var] = source[var], counting up by one
+   Idiom_Copy,
+   /// sum = sum + source[var]
+   Idiom_Sum
+};
+
+/// A for loop whose variable var only changes by step, in the increment
+struct InductionLoop {
+   VarSlot var;
+   int64_t step;
+   std::vector<Cursor> cursors;
+   /// Invariant bound the test compares var against, NULL if the test has
+   /// to be evaluated. Otherwise the bound is kept in slot limit and the
+   /// trips left in slot trips.
+   Expr * bound;
+   unsigned limit;
+   unsigned trips;
+   /// Cursors, by index, and operands of the idiom of a counted loop
+   LoopIdiom idiom;
+   unsigned target;
+   unsigned source;
+   Expr * value;
+   VarSlot sum;
+};
+
+/// Pre-pass describing every node whose execution depends on its type, so
+/// that the executor switches on a handler instead of inspecting types.
+/// Nodes are described bottom-up, which folds operators over constants in
+/// the same pass: an operator whose operands are literals, sizeofs, folded
+/// operators or const variables with a constant initializer becomes a
+/// Node_Constant, computed with the interpreter's own arithmetic.
+///
+/// Loops are then searched for operators whose operands are not written
+/// inside the loop. Each largest such operator gets a slot of its own in
+/// the frame and is computed once before the loop starts.
+///
+/// A for loop whose increment adds a constant to a local variable, which
+/// nothing else in the loop writes, has that variable as induction
+/// variable. Its subscripts of invariant arrays become pointers bumped by
+/// the element stride, and a test against an invariant bound becomes a
+/// count of the trips left.
+class NodeTable {
+   /// Small functions substituted at their call sites
+   struct InlineBody {
+	   Expr * body;
+	   /// Slot of the first parameter in the frame of every caller
+	   unsigned base;
+   };
+   /// Nodes a returned expression may have to be inlined
+   static constexpr unsigned InlineBudget = 16;
+
+   /// Variables written inside the loop being searched
+   struct LoopWrites {
+	   llvm::SmallPtrSet<const VarDecl *, 16> vars;
+	   /// A call to a user function may write any global
+	   bool globals;
+   };
+
+   llvm::DenseMap<const Stmt *, NodeInfo> mNodes;
+   llvm::DenseMap<const VarDecl *, NodeInfo> mDecls;
+   llvm::DenseMap<const Stmt *, std::vector<Expr *>> mHoisted;
+   llvm::DenseMap<const Stmt *, InductionLoop> mInductions;
+   llvm::DenseMap<const FunctionDecl *, InlineBody> mInlined;
+   ASTContext * mContext;
+   FrameLayout * mLayout;
+   /// Function and loop being searched for invariant operators
+   FunctionDecl * mFunction;
+   Stmt * mLoop;
+public:
+   NodeTable() : mNodes(), mDecls(), mHoisted(), mInductions(), mInlined(), mContext(NULL), mLayout(NULL), mFunction(NULL), mLoop(NULL) {
+   }
+
+   void build(TranslationUnitDecl * unit, FrameLayout & layout) {
+	   mContext = &unit->getASTContext();
+	   mLayout = &layout;
+	   for (Decl * decl : unit->decls())
+		   if (FunctionDecl * fdecl = dyn_cast<FunctionDecl>(decl))
+			   if (fdecl->doesThisDeclarationHaveABody()) {
+				   describeStmt(fdecl->getBody());
+				   mFunction = fdecl;
+				   findLoops(fdecl->getBody());
+			   }
+	   inlineSmall(unit);
+   }
+
+   /// The expression def returns, if its calls are inlined, and where its
+   /// parameters live in the caller's frame
+   Expr * inlinedBody(const FunctionDecl * def, unsigned & base) {
+	   auto it = mInlined.find(def);
+	   if (it == mInlined.end())
+		   return NULL;
+	   base = it->second.base;
+	   return it->second.body;
+   }
+
+   /// Operators to compute, in order, each time before loop starts
+   llvm::ArrayRef<Expr *> hoistedBefore(const Stmt * loop) {
+	   auto it = mHoisted.find(loop);
+	   if (it == mHoisted.end())
+		   return llvm::ArrayRef<Expr *>();
+	   return it->second;
+   }
+
+   /// Induction variable of a for loop, NULL if it has none worth reducing
+   const InductionLoop * induction(const Stmt * loop) {
+	   auto it = mInductions.find(loop);
+	   return it == mInductions.end() ? NULL : &it->second;
+   }
+
+   const NodeInfo & lookup(const Stmt * stmt) {
+	   assert(mNodes.find(stmt) != mNodes.end());
+	   return mNodes.find(stmt)->second;
+   }
+   const NodeInfo & lookup(const VarDecl * vardecl) {
+	   assert(mDecls.find(vardecl) != mDecls.end());
+	   return mDecls.find(vardecl)->second;
+   }
+
+   /// Whether expr was folded, and to which value. Looks through the
+   /// parentheses and casts the interpreter ignores.
+   bool constant(const Expr * expr, int64_t & value) {
+	   expr = expr->IgnoreParenCasts();
+	   if (const IntegerLiteral * intlt = dyn_cast<IntegerLiteral>(expr)) {
+		   value = intlt->getValue().getSExtValue();
+		   return true;
+	   }
+	   if (const CharacterLiteral * charlt = dyn_cast<CharacterLiteral>(expr)) {
+		   value = charlt->getValue();
+		   return true;
+	   }
+	   auto it = mNodes.find(expr);
+	   if (it == mNodes.end())
+		   return false;
+	   if (it->second.handler == Node_SizeOf)
+		   value = it->second.width;
+	   else if (it->second.handler == Node_Constant)
+		   value = it->second.value;
+	   else
+		   return false;
+	   return true;
+   }
+
+   /// Whether stmt never completes normally: it returns, breaks or continues
+   /// on every path
+   bool leaves(const Stmt * stmt) {
+	   if (!stmt)
+		   return false;
+	   if (isa<ReturnStmt>(stmt) || isa<BreakStmt>(stmt) || isa<ContinueStmt>(stmt))
+		   return true;
+	   if (const CompoundStmt * compound = dyn_cast<CompoundStmt>(stmt))
+		   return lookup(compound).live < compound->size() ||
+			   (compound->size() && leaves(compound->body_back()));
+	   if (const IfStmt * ifstmt = dyn_cast<IfStmt>(stmt)) {
+		   int64_t cond;
+		   if (constant(ifstmt->getCond(), cond))
+			   return leaves(cond ? ifstmt->getThen() : ifstmt->getElse());
+		   return leaves(ifstmt->getThen()) && leaves(ifstmt->getElse());
+	   }
+	   return false;
+   }
+
+private:
+   /// Same as Environment::elementWidth: chars are packed, everything else
+   /// takes a cell
+   static uint8_t width(QualType type) {
+	   return type->isCharType() ? 1 : 8;
+   }
+   static ValueKind kind(QualType type) {
+	   if (type.isNull())
+		   return Value_None;
+	   if (type->isArrayType())
+		   return Value_Array;
+	   if (type->isPointerType())
+		   return Value_Pointer;
+	   if (type->isIntegerType())
+		   return Value_Integer;
+	   return Value_None;
+   }
+   static NodeInfo info(NodeHandler handler, QualType type) {
+	   NodeInfo node = { handler, kind(type), 8, false, false, false, { 0, false }, 0, 0, 0 };
+	   if (node.kind == Value_Pointer)
+		   node.width = width(type->getPointeeType());
+	   else if (node.kind == Value_Array)
+		   node.width = width(type->getAsArrayTypeUnsafe()->getElementType());
+	   return node;
+   }
+
+   void describeStmt(Stmt * stmt) {
+	   if (!stmt)
+		   return;
+	   for (Stmt * child : stmt->children())
+		   describeStmt(child);
+	   if (DeclStmt * declstmt = dyn_cast<DeclStmt>(stmt)) {
+		   for (Decl * decl : declstmt->decls())
+			   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl))
+				   describe(vardecl);
+	   } else if (DeclRefExpr * declref = dyn_cast<DeclRefExpr>(stmt)) {
+		   describe(declref);
+	   } else if (BinaryOperator * bop = dyn_cast<BinaryOperator>(stmt)) {
+		   describe(bop);
+	   } else if (ArraySubscriptExpr * ase = dyn_cast<ArraySubscriptExpr>(stmt)) {
+		   NodeInfo node = info(Node_Load64, ase->getType());
+		   node.width = width(ase->getType());
+		   if (node.width == 1)
+			   node.handler = Node_Load8;
+		   mNodes[ase] = node;
+	   } else if (UnaryExprOrTypeTraitExpr * uette = dyn_cast<UnaryExprOrTypeTraitExpr>(stmt)) {
+		   NodeInfo node = info(Node_SizeOf, uette->getType());
+		   node.width = 8;
+		   if (uette->getKind() == UETT_SizeOf && uette->getTypeOfArgument()->isCharType())
+			   node.width = 1;
+		   mNodes[uette] = node;
+	   } else if (UnaryOperator * uop = dyn_cast<UnaryOperator>(stmt)) {
+		   NodeInfo node = info(Node_Operator, uop->getType());
+		   int64_t val;
+		   if ((uop->getOpcode() == UO_Minus || uop->getOpcode() == UO_Plus) && constant(uop->getSubExpr(), val)) {
+			   node.handler = Node_Constant;
+			   node.value = uop->getOpcode() == UO_Minus ? -val : val;
+		   }
+		   if (uop->getOpcode() == UO_Deref)
+			   node.width = width(uop->getType());
+		   mNodes[uop] = node;
+	   } else if (CompoundStmt * compound = dyn_cast<CompoundStmt>(stmt)) {
+		   NodeInfo node = info(Node_Block, QualType());
+		   node.live = 0;
+		   for (Stmt * child : compound->body()) {
+			   node.live++;
+			   if (leaves(child))
+				   break;
+		   }
+		   mNodes[compound] = node;
+	   }
+   }
+
+   void describe(VarDecl * vardecl) {
+	   QualType type = vardecl->getType();
+	   NodeInfo node = info(Node_Ignore, type);
+	   node.slot = mLayout->getSlot(vardecl);
+	   if (type->isIntegerType() || type->isCharType() || type->isPointerType()) {
+		   node.handler = Node_DeclScalar;
+		   node.init = vardecl->hasInit();
+	   } else if (const ConstantArrayType * carray = dyn_cast<ConstantArrayType>(type.getTypePtr())) {
+		   QualType element = carray->getElementType();
+		   if (element->isIntegerType() || element->isPointerType()) {
+			   node.handler = Node_DeclArray;
+			   node.bytes = carray->getSize().getSExtValue() * node.width;
+		   } else {
+			   node.handler = Node_Unsupported;
+		   }
+	   }
+	   mDecls[vardecl] = node;
+   }
+
+   void describe(DeclRefExpr * declref) {
+	   QualType type = declref->getType();
+	   NodeInfo node = info(Node_Ignore, type);
+	   if (node.kind != Value_None) {
+		   VarDecl * vardecl = dyn_cast<VarDecl>(declref->getDecl());
+		   node.handler = vardecl ? Node_LoadVar : Node_Unsupported;
+		   if (vardecl) {
+			   node.slot = mLayout->getSlot(vardecl);
+			   if (constantVar(vardecl, node.value))
+				   node.handler = Node_Constant;
+		   }
+	   }
+	   mNodes[declref] = node;
+   }
+
+   /// A const integer variable keeps the value of its initializer. Globals
+   /// hold what Environment::constantValue computed, Clang's evaluation;
+   /// the initializer of a local must have been folded itself.
+   bool constantVar(VarDecl * vardecl, int64_t & value) {
+	   QualType type = vardecl->getType();
+	   if (!type.isConstQualified() || !type->isIntegerType() || !vardecl->hasInit())
+		   return false;
+	   if (!vardecl->hasGlobalStorage())
+		   return constant(vardecl->getInit(), value);
+	   Expr::EvalResult result;
+	   if (!vardecl->getInit()->EvaluateAsInt(result, *mContext))
+		   return false;
+	   value = result.Val.getInt().getSExtValue();
+	   return true;
+   }
+
+   void describe(BinaryOperator * bop) {
+	   Expr * left = bop->getLHS();
+	   if (bop->isAssignmentOp()) {
+		   NodeInfo node = info(Node_Unsupported, left->getType());
+		   if (DeclRefExpr * declexpr = dyn_cast<DeclRefExpr>(left)) {
+			   if (VarDecl * vardecl = dyn_cast<VarDecl>(declexpr->getDecl())) {
+				   node.handler = Node_StoreVar;
+				   node.slot = mLayout->getSlot(vardecl);
+			   }
+		   } else if (ArraySubscriptExpr * ase = dyn_cast<ArraySubscriptExpr>(left)) {
+			   node.width = width(ase->getType());
+			   node.handler = node.width == 1 ? Node_Store8 : Node_Store64;
+		   } else if (UnaryOperator * uop = dyn_cast<UnaryOperator>(left)) {
+			   if (uop->getOpcode() == UO_Deref) {
+				   node.width = width(uop->getType());
+				   node.handler = Node_StoreDeref;
+			   }
+		   }
+		   mNodes[bop] = node;
+	   } else {
+		   NodeInfo node = info(Node_Operator, left->getType());
+		   if (bop->getOpcode() == BO_Add)
+			   node.handler = Node_AddInteger;
+		   /// A pointer steps by the width of its element
+		   if (bop->getOpcode() == BO_Add && node.kind == Value_Pointer)
+			   node.handler = Node_AddPointer;
+		   if (node.kind == Value_Integer && fold(bop, node.value))
+			   node.handler = Node_Constant;
+		   mNodes[bop] = node;
+	   }
+   }
+
+   /// Loops are searched outermost first, so that an operator invariant in
+   /// several nested loops is computed before the outermost of them
+   void findLoops(Stmt * stmt) {
+	   if (!stmt)
+		   return;
+	   if (isa<WhileStmt>(stmt) || isa<ForStmt>(stmt))
+		   hoistLoop(stmt);
+	   if (ForStmt * fstmt = dyn_cast<ForStmt>(stmt))
+		   reduceLoop(fstmt);
+	   for (Stmt * child : stmt->children())
+		   findLoops(child);
+   }
+
+   void hoistLoop(Stmt * loop) {
+	   LoopWrites writes;
+	   writes.globals = false;
+	   Stmt * init = NULL;
+	   if (ForStmt * fstmt = dyn_cast<ForStmt>(loop))
+		   init = fstmt->getInit();
+	   /// the init of a for runs once, before the hoisted operators
+	   for (Stmt * child : loop->children())
+		   if (child != init)
+			   collectWrites(child, writes);
+	   mLoop = loop;
+	   for (Stmt * child : loop->children())
+		   if (child != init)
+			   findInvariant(child, writes);
+   }
+
+   void collectWrites(Stmt * stmt, LoopWrites & writes) {
+	   if (!stmt)
+		   return;
+	   if (DeclStmt * declstmt = dyn_cast<DeclStmt>(stmt)) {
+		   for (Decl * decl : declstmt->decls())
+			   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl))
+				   writes.vars.insert(vardecl);
+	   } else if (BinaryOperator * bop = dyn_cast<BinaryOperator>(stmt)) {
+		   if (bop->isAssignmentOp())
+			   if (DeclRefExpr * declref = dyn_cast<DeclRefExpr>(bop->getLHS()->IgnoreParens()))
+				   if (VarDecl * vardecl = dyn_cast<VarDecl>(declref->getDecl()))
+					   writes.vars.insert(vardecl);
+	   } else if (CallExpr * call = dyn_cast<CallExpr>(stmt)) {
+		   FunctionDecl * callee = call->getDirectCallee();
+		   if (!callee || callee->getDefinition())
+			   writes.globals = true;
+	   }
+	   for (Stmt * child : stmt->children())
+		   collectWrites(child, writes);
+   }
+
+   /// Whether stmt is an expression with the same value in every iteration
+   /// of the loop. Otherwise its largest invariant operators are hoisted.
+   bool findInvariant(Stmt * stmt, const LoopWrites & writes) {
+	   if (!stmt)
+		   return false;
+	   Expr * expr = dyn_cast<Expr>(stmt);
+	   if (expr && (isa<IntegerLiteral>(expr) || isa<CharacterLiteral>(expr) ||
+				   isa<UnaryExprOrTypeTraitExpr>(expr)))
+		   return true;
+	   if (expr && mNodes.count(expr) &&
+			   (mNodes[expr].handler == Node_Constant || mNodes[expr].hoisted))
+		   return true;
+	   bool operands = true;
+	   llvm::SmallVector<Expr *, 4> invariant;
+	   for (Stmt * child : stmt->children()) {
+		   if (findInvariant(child, writes))
+			   invariant.push_back(cast<Expr>(child));
+		   else
+			   operands = false;
+	   }
+	   if (operands && expr && invariantNode(expr, writes))
+		   return true;
+	   for (Expr * child : invariant)
+		   hoist(child);
+	   return false;
+   }
+
+   /// Whether expr has no side effect, can not trap and reads no memory,
+   /// given that its operands are invariant
+   bool invariantNode(Expr * expr, const LoopWrites & writes) {
+	   if (isa<ParenExpr>(expr))
+		   return true;
+	   if (CastExpr * castexpr = dyn_cast<CastExpr>(expr))
+		   return castexpr->getCastKind() != CK_FunctionToPointerDecay;
+	   if (DeclRefExpr * declref = dyn_cast<DeclRefExpr>(expr)) {
+		   VarDecl * vardecl = dyn_cast<VarDecl>(declref->getDecl());
+		   if (!vardecl || lookup(declref).handler != Node_LoadVar)
+			   return false;
+		   return !writes.vars.count(vardecl) && !(writes.globals && vardecl->hasGlobalStorage());
+	   }
+	   if (UnaryOperator * uop = dyn_cast<UnaryOperator>(expr))
+		   return uop->getOpcode() == UO_Minus || uop->getOpcode() == UO_Plus;
+	   if (BinaryOperator * bop = dyn_cast<BinaryOperator>(expr)) {
+		   int64_t divisor;
+		   switch (bop->getOpcode()) {
+			   case BO_Add:
+			   case BO_Sub:
+			   case BO_Mul:
+			   case BO_LT:
+			   case BO_GT:
+			   case BO_EQ:
+				   return true;
+			   case BO_Div:
+				   return constant(bop->getRHS(), divisor) && divisor != 0 && divisor != -1;
+			   default:
+				   return false;
+		   }
+	   }
+	   return false;
+   }
+
+   /// Operands alone are cheap to evaluate, only operators are worth a slot
+   void hoist(Expr * expr) {
+	   expr = expr->IgnoreParenCasts();
+	   if (!isa<BinaryOperator>(expr) && !isa<UnaryOperator>(expr))
+		   return;
+	   NodeInfo & node = mNodes[expr];
+	   if (node.handler == Node_Constant || node.hoisted)
+		   return;
+	   node.hoisted = true;
+	   node.slot.index = mLayout->addSlot(mFunction);
+	   node.slot.global = false;
+	   mHoisted[mLoop].push_back(expr);
+   }
+
+   /// Loops are reduced outermost first too: a subscript of the variable of
+   /// an outer loop keeps its cursor inside the inner loops
+   void reduceLoop(ForStmt * fstmt) {
+	   VarDecl * var;
+	   int64_t step;
+	   if (!inductionStep(fstmt->getInc(), var, step))
+		   return;
+	   LoopWrites writes;
+	   writes.globals = false;
+	   collectWrites(fstmt->getCond(), writes);
+	   collectWrites(fstmt->getBody(), writes);
+	   if (writes.vars.count(var))
+		   return;
+	   collectWrites(fstmt->getInc(), writes);
+	   InductionLoop loop = { mLayout->getSlot(var), step, {}, NULL, 0, 0, Idiom_None, 0, 0, NULL, { 0, false } };
+	   findCursors(fstmt->getCond(), var, writes, loop);
+	   findCursors(fstmt->getBody(), var, writes, loop);
+	   countTrips(fstmt->getCond(), var, writes, loop);
+	   if (loop.bound)
+		   findIdiom(fstmt->getBody(), var, writes, loop);
+	   if (!loop.cursors.empty() || loop.bound)
+		   mInductions[fstmt] = loop;
+   }
+
+   /// The increment is var = var + K, var = K + var or var = var - K, with
+   /// var a local variable and K a nonzero constant
+   bool inductionStep(Expr * inc, VarDecl *& var, int64_t & step) {
+	   BinaryOperator * assign = dyn_cast_or_null<BinaryOperator>(inc ? inc->IgnoreParens() : NULL);
+	   if (!assign || assign->getOpcode() != BO_Assign || lookup(assign).handler != Node_StoreVar)
+		   return false;
+	   var = cast<VarDecl>(cast<DeclRefExpr>(assign->getLHS()->IgnoreParens())->getDecl());
+	   if (var->hasGlobalStorage() || !var->getType()->isIntegerType())
+		   return false;
+	   BinaryOperator * bop = dyn_cast<BinaryOperator>(assign->getRHS()->IgnoreParenCasts());
+	   if (!bop || lookup(bop).handler == Node_Constant)
+		   return false;
+	   if (bop->getOpcode() == BO_Add && refersTo(bop->getLHS(), var) && constant(bop->getRHS(), step))
+		   return step != 0;
+	   if (bop->getOpcode() == BO_Add && refersTo(bop->getRHS(), var) && constant(bop->getLHS(), step))
+		   return step != 0;
+	   if (bop->getOpcode() == BO_Sub && refersTo(bop->getLHS(), var) && constant(bop->getRHS(), step)) {
+		   step = -step;
+		   return step != 0;
+	   }
+	   return false;
+   }
+   static bool refersTo(Expr * expr, VarDecl * var) {
+	   DeclRefExpr * declref = dyn_cast<DeclRefExpr>(expr->IgnoreParenCasts());
+	   return declref && declref->getDecl() == var;
+   }
+
+   /// Index var, var + K, K + var or var - K, offset K
+   bool indexOffset(Expr * idx, VarDecl * var, int64_t & offset) {
+	   offset = 0;
+	   if (refersTo(idx, var))
+		   return true;
+	   BinaryOperator * bop = dyn_cast<BinaryOperator>(idx->IgnoreParenCasts());
+	   if (!bop || lookup(bop).handler == Node_Constant)
+		   return false;
+	   if (bop->getOpcode() == BO_Add && refersTo(bop->getLHS(), var))
+		   return constant(bop->getRHS(), offset);
+	   if (bop->getOpcode() == BO_Add && refersTo(bop->getRHS(), var))
+		   return constant(bop->getLHS(), offset);
+	   if (bop->getOpcode() == BO_Sub && refersTo(bop->getLHS(), var) && constant(bop->getRHS(), offset)) {
+		   offset = -offset;
+		   return true;
+	   }
+	   return false;
+   }
+
+   /// A variable the loop does not write, as for findInvariant
+   DeclRefExpr * invariantVar(Expr * expr, const LoopWrites & writes) {
+	   DeclRefExpr * declref = dyn_cast<DeclRefExpr>(expr->IgnoreParenCasts());
+	   if (!declref || lookup(declref).handler != Node_LoadVar)
+		   return NULL;
+	   VarDecl * vardecl = cast<VarDecl>(declref->getDecl());
+	   if (writes.vars.count(vardecl) || (writes.globals && vardecl->hasGlobalStorage()))
+		   return NULL;
+	   return declref;
+   }
+
+   void findCursors(Stmt * stmt, VarDecl * var, const LoopWrites & writes, InductionLoop & loop) {
+	   if (!stmt)
+		   return;
+	   if (ArraySubscriptExpr * ase = dyn_cast<ArraySubscriptExpr>(stmt))
+		   addCursor(ase, ase, var, writes, loop);
+	   else if (BinaryOperator * bop = dyn_cast<BinaryOperator>(stmt))
+		   if (bop->getOpcode() == BO_Assign)
+			   if (ArraySubscriptExpr * ase = dyn_cast<ArraySubscriptExpr>(bop->getLHS()))
+				   addCursor(bop, ase, var, writes, loop);
+	   for (Stmt * child : stmt->children())
+		   findCursors(child, var, writes, loop);
+   }
+
+   /// Subscripts of the same array at the same offset share a cursor
+   void addCursor(Expr * expr, ArraySubscriptExpr * ase, VarDecl * var, const LoopWrites & writes,
+		   InductionLoop & loop) {
+	   NodeInfo & node = mNodes[expr];
+	   int64_t offset;
+	   DeclRefExpr * base = invariantVar(ase->getBase(), writes);
+	   if (node.cursor || !base || lookup(base).kind == Value_Integer || !indexOffset(ase->getIdx(), var, offset))
+		   return;
+	   VarSlot slot = lookup(base).slot;
+	   for (const Cursor & cursor : loop.cursors)
+		   if (cursor.base.index == slot.index && cursor.base.global == slot.global &&
+				   cursor.offset == offset && cursor.width == node.width) {
+			   node.cursor = true;
+			   node.slot.index = cursor.slot;
+			   node.slot.global = false;
+			   return;
+		   }
+	   Cursor cursor = { slot, offset, node.width, mLayout->addSlot(mFunction) };
+	   loop.cursors.push_back(cursor);
+	   node.cursor = true;
+	   node.slot.index = cursor.slot;
+	   node.slot.global = false;
+   }
+
+   /// The test is var < bound counting up or var > bound counting down,
+   /// either way round, against a constant, an invariant variable or a
+   /// hoisted operator
+   void countTrips(Expr * cond, VarDecl * var, const LoopWrites & writes, InductionLoop & loop) {
+	   BinaryOperator * bop = dyn_cast_or_null<BinaryOperator>(cond ? cond->IgnoreParenCasts() : NULL);
+	   if (!bop || (bop->getOpcode() != BO_LT && bop->getOpcode() != BO_GT))
+		   return;
+	   Expr * bound;
+	   bool below;
+	   if (refersTo(bop->getLHS(), var)) {
+		   bound = bop->getRHS();
+		   below = bop->getOpcode() == BO_LT;
+	   } else if (refersTo(bop->getRHS(), var)) {
+		   bound = bop->getLHS();
+		   below = bop->getOpcode() == BO_GT;
+	   } else
+		   return;
+	   if (below != (loop.step > 0))
+		   return;
+	   int64_t value;
+	   Expr * inner = bound->IgnoreParenCasts();
+	   bool hoisted = mNodes.count(inner) && mNodes[inner].hoisted;
+	   if (!constant(bound, value) && !hoisted && !invariantVar(bound, writes))
+		   return;
+	   loop.bound = bound;
+	   loop.limit = mLayout->addSlot(mFunction);
+	   loop.trips = mLayout->addSlot(mFunction);
+   }
+
+   /// The body is a single assignment through the cursors of this loop.
+   /// A fill or a sum may count either way, a copy only up, for it to move
+   /// the elements in the order the loop does.
+   void findIdiom(Stmt * body, VarDecl * var, const LoopWrites & writes, InductionLoop & loop) {
+	   if (CompoundStmt * compound = dyn_cast<CompoundStmt>(body))
+		   body = compound->size() == 1 ? compound->body_front() : NULL;
+	   BinaryOperator * assign = dyn_cast_or_null<BinaryOperator>(body);
+	   if (!assign || assign->getOpcode() != BO_Assign || (loop.step != 1 && loop.step != -1))
+		   return;
+	   Expr * right = assign->getRHS()->IgnoreParenCasts();
+	   int64_t value;
+	   if (ownCursor(assign, loop, loop.target)) {
+		   if (ownCursor(right, loop, loop.source)) {
+			   if (loop.step == 1 && loop.cursors[loop.source].width == loop.cursors[loop.target].width)
+				   loop.idiom = Idiom_Copy;
+		   } else if (constant(right, value) || (mNodes.count(right) && mNodes[right].hoisted) ||
+				   invariantVar(right, writes)) {
+			   loop.idiom = Idiom_Fill;
+			   loop.value = assign->getRHS();
+		   }
+		   return;
+	   }
+	   BinaryOperator * add = dyn_cast<BinaryOperator>(right);
+	   if (lookup(assign).handler != Node_StoreVar || !add || add->getOpcode() != BO_Add)
+		   return;
+	   DeclRefExpr * declref = cast<DeclRefExpr>(assign->getLHS());
+	   VarDecl * sum = cast<VarDecl>(declref->getDecl());
+	   if (sum == var || !sum->getType()->isIntegerType())
+		   return;
+	   Expr * element = refersTo(add->getLHS(), sum) ? add->getRHS() : add->getLHS();
+	   if (element != add->getRHS() && !refersTo(add->getRHS(), sum))
+		   return;
+	   if (ownCursor(element->IgnoreParenCasts(), loop, loop.source)) {
+		   loop.idiom = Idiom_Sum;
+		   loop.sum = lookup(assign).slot;
+	   }
+   }
+   /// Whether expr goes through a cursor of loop, and which
+   bool ownCursor(Expr * expr, const InductionLoop & loop, unsigned & index) {
+	   auto it = mNodes.find(expr);
+	   if (it == mNodes.end() || !it->second.cursor)
+		   return false;
+	   for (index = 0; index < loop.cursors.size(); index++)
+		   if (loop.cursors[index].slot == it->second.slot.index)
+			   return true;
+	   return false;
+   }
+
+   /// A function is inlined when its body is a single return of an
+   /// expression within InlineBudget nodes, which makes no call and assigns
+   /// nothing: it can not recurse and only reads its parameters. Parameters
+   /// are renamed to a range of slots past the frame of every function, the
+   /// same range in each caller, so that the shared body reads them there.
+   void inlineSmall(TranslationUnitDecl * unit) {
+	   std::vector<FunctionDecl *> functions;
+	   unsigned top = 0;
+	   for (Decl * decl : unit->decls())
+		   if (FunctionDecl * fdecl = dyn_cast<FunctionDecl>(decl))
+			   if (fdecl->doesThisDeclarationHaveABody()) {
+				   functions.push_back(fdecl);
+				   top = std::max(top, mLayout->getFunction(fdecl).numSlots);
+			   }
+	   unsigned end = top;
+	   for (FunctionDecl * fdecl : functions) {
+		   Expr * body = inlineCandidate(fdecl);
+		   if (!body)
+			   continue;
+		   InlineBody inlined = { body, end };
+		   mInlined[fdecl] = inlined;
+		   renameParams(body, end);
+		   end += fdecl->getNumParams();
+	   }
+	   if (end == top)
+		   return;
+	   for (FunctionDecl * fdecl : functions)
+		   if (callsInlined(fdecl->getBody()))
+			   mLayout->reserveSlots(fdecl, end);
+   }
+
+   Expr * inlineCandidate(FunctionDecl * fdecl) {
+	   CompoundStmt * body = dyn_cast<CompoundStmt>(fdecl->getBody());
+	   if (fdecl->isMain() || !body || body->size() != 1)
+		   return NULL;
+	   ReturnStmt * rstmt = dyn_cast<ReturnStmt>(body->body_front());
+	   if (!rstmt || !rstmt->getRetValue())
+		   return NULL;
+	   unsigned size = 0;
+	   return inlineable(rstmt->getRetValue(), size) ? rstmt->getRetValue() : NULL;
+   }
+   bool inlineable(Stmt * stmt, unsigned & size) {
+	   if (++size > InlineBudget || isa<CallExpr>(stmt))
+		   return false;
+	   if (BinaryOperator * bop = dyn_cast<BinaryOperator>(stmt))
+		   if (bop->isAssignmentOp())
+			   return false;
+	   for (Stmt * child : stmt->children())
+		   if (child && !inlineable(child, size))
+			   return false;
+	   return true;
+   }
+
+   void renameParams(Stmt * stmt, unsigned base) {
+	   if (DeclRefExpr * declref = dyn_cast<DeclRefExpr>(stmt))
+		   if (ParmVarDecl * param = dyn_cast<ParmVarDecl>(declref->getDecl())) {
+			   NodeInfo & node = mNodes[declref];
+			   if (node.handler == Node_LoadVar) {
+				   node.slot.index = base + param->getFunctionScopeIndex();
+				   node.slot.global = false;
+			   }
+		   }
+	   for (Stmt * child : stmt->children())
+		   if (child)
+			   renameParams(child, base);
+   }
+
+   bool callsInlined(Stmt * stmt) {
+	   if (CallExpr * call = dyn_cast<CallExpr>(stmt))
+		   if (FunctionDecl * callee = call->getDirectCallee())
+			   if (callee->getDefinition() && mInlined.count(callee->getDefinition()))
+				   return true;
+	   for (Stmt * child : stmt->children())
+		   if (child && callsInlined(child))
+			   return true;
+	   return false;
+   }
+
+   /// Operators of Environment::binop over integer constants. Division by
+   /// zero and unsupported operators are left to fail when executed.
+   bool fold(BinaryOperator * bop, int64_t & value) {
+	   int64_t lval, rval;
+	   if (!constant(bop->getLHS(), lval) || !constant(bop->getRHS(), rval))
+		   return false;
+	   switch (bop->getOpcode()) {
+		   case BO_Add:
+			   value = lval + rval;
+			   return true;
+		   case BO_Sub:
+			   value = lval - rval;
+			   return true;
+		   case BO_Mul:
+			   value = lval * rval;
+			   return true;
+		   case BO_Div:
+			   if (rval == 0 || (rval == -1 && lval == INT64_MIN))
+				   return false;
+			   value = lval / rval;
+			   return true;
+		   case BO_LT:
+			   value = lval < rval;
+			   return true;
+		   case BO_GT:
+			   value = lval > rval;
+			   return true;
+		   case BO_EQ:
+			   value = lval == rval;
+			   return true;
+		   default:
+			   return false;
+	   }
+   }
+};
+
+#endif
@@ -0,0 +1,228 @@
+//==--- ProgramImage.h - Serialized bytecode program ----------------------===//
+//===----------------------------------------------------------------------===//
+#ifndef _PROGRAMIMAGE_H_
+#define _PROGRAMIMAGE_H_
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "Bytecode.h"
+#include "Environment.h"
+
+/// A compiled program, ready to run on the VM without Clang. Every section
+/// is 8-byte aligned and read in place from the mapping:
+///   ImageHeader
+///   ImageFunction[numFunctions]
+///   ImageReloc[numRelocs]	cells holding the address of a global array
+///   int64_t[numDataWords]	DataSegment, cells then array storage
+///   int64_t[numConsts]	constants of every function
+///   Instr[numInstrs]		code of every function
+struct ImageHeader {
+   char magic[8];
+   uint32_t version;
+   uint32_t numFunctions;
+   uint32_t entry;
+   uint32_t numCells;
+   uint64_t numRelocs;
+   uint64_t numDataWords;
+   uint64_t numConsts;
+   uint64_t numInstrs;
+};
+
+struct ImageFunction {
+   uint32_t numParams;
+   uint32_t numRegs;
+   uint64_t firstConst;
+   uint64_t numConsts;
+   uint64_t firstInstr;
+   uint64_t numInstrs;
+};
+
+struct ImageReloc {
+   uint64_t cell;
+   /// Offset of the array in the array storage of the DataSegment
+   int64_t offset;
+};
+
+class ProgramImage {
+   static constexpr char Magic[8] = { 't', 'i', 'n', 'y', 'i', 'm', 'g', '\0' };
+   /// Bumped whenever the image layout or the bytecode changes
+   static constexpr uint32_t Version = 1;
+public:
+   /// Write module and the globals of env after Environment::init
+   static void write(const std::string & path, BcModule & module, Environment & env) {
+	   DataSegment & data = env.getDataSegment();
+	   std::vector<ImageFunction> functions;
+	   std::vector<int64_t> consts;
+	   std::vector<Instr> code;
+	   for (const BcFunction & fn : module.functions) {
+		   ImageFunction image = { fn.numParams, fn.numRegs, consts.size(), fn.consts.size(), code.size(), fn.code.size() };
+		   functions.push_back(image);
+		   consts.insert(consts.end(), fn.consts.begin(), fn.consts.end());
+		   code.insert(code.end(), fn.code.begin(), fn.code.end());
+	   }
+	   std::vector<ImageReloc> relocs;
+	   for (unsigned cell = 0; cell < module.globals.size(); cell++)
+		   if (isa<ConstantArrayType>(module.globals[cell]->getType().getTypePtr())) {
+			   ImageReloc reloc = { cell, data.get(cell) - data.arrayAddress(0) };
+			   relocs.push_back(reloc);
+		   }
+
+	   ImageHeader header;
+	   memcpy(header.magic, Magic, sizeof(Magic));
+	   header.version = Version;
+	   header.numFunctions = functions.size();
+	   header.entry = module.entry;
+	   header.numCells = module.globals.size();
+	   header.numRelocs = relocs.size();
+	   header.numDataWords = data.size();
+	   header.numConsts = consts.size();
+	   header.numInstrs = code.size();
+
+	   std::error_code ec;
+	   llvm::raw_fd_ostream out(path, ec);
+	   if (ec) {
+		   llvm::errs() << "can not write " << path << "\n";
+		   exit(0);
+	   }
+	   out.write((const char *)&header, sizeof(header));
+	   out.write((const char *)functions.data(), functions.size() * sizeof(ImageFunction));
+	   out.write((const char *)relocs.data(), relocs.size() * sizeof(ImageReloc));
+	   out.write((const char *)data.cells(), data.size() * sizeof(int64_t));
+	   out.write((const char *)consts.data(), consts.size() * sizeof(int64_t));
+	   out.write((const char *)code.data(), code.size() * sizeof(Instr));
+   }
+
+   /// Map the image at path. Functions are rebuilt from the mapped sections
+   /// and the DataSegment of env is laid out from the image.
+   static void load(const std::string & path, BcModule & module, Environment & env) {
+	   int fd = open(path.c_str(), O_RDONLY);
+	   struct stat st;
+	   if (fd < 0 || fstat(fd, &st) != 0) {
+		   llvm::errs() << "can not open " << path << "\n";
+		   exit(0);
+	   }
+	   size_t size = st.st_size;
+	   void * map = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	   close(fd);
+	   const ImageHeader * header = (const ImageHeader *)map;
+	   if (map == MAP_FAILED || size < sizeof(ImageHeader) || memcmp(header->magic, Magic, sizeof(Magic)) != 0
+			   || header->version != Version) {
+		   llvm::errs() << path << " is not a program image of this interpreter\n";
+		   exit(0);
+	   }
+	   /// counts beyond the size would wrap the expected size around
+	   if (header->numRelocs > size || header->numDataWords > size || header->numConsts > size
+			   || header->numInstrs > size) {
+		   llvm::errs() << path << " is truncated\n";
+		   exit(0);
+	   }
+	   size_t expected = sizeof(ImageHeader) + header->numFunctions * sizeof(ImageFunction)
+		   + header->numRelocs * sizeof(ImageReloc)
+		   + (header->numDataWords + header->numConsts) * sizeof(int64_t) + header->numInstrs * sizeof(Instr);
+	   if (size != expected || header->entry >= header->numFunctions || header->numCells > header->numDataWords) {
+		   llvm::errs() << path << " is truncated\n";
+		   exit(0);
+	   }
+	   const ImageFunction * functions = (const ImageFunction *)(header + 1);
+	   const ImageReloc * relocs = (const ImageReloc *)(functions + header->numFunctions);
+	   const int64_t * data = (const int64_t *)(relocs + header->numRelocs);
+	   const int64_t * consts = data + header->numDataWords;
+	   const Instr * code = (const Instr *)(consts + header->numConsts);
+
+	   DataSegment & segment = env.getDataSegment();
+	   segment.layout(header->numCells, (header->numDataWords - header->numCells) * sizeof(int64_t));
+	   memcpy(segment.cells(), data, header->numDataWords * sizeof(int64_t));
+	   int64_t arrayBytes = (header->numDataWords - header->numCells) * sizeof(int64_t);
+	   for (uint64_t i = 0; i < header->numRelocs; i++) {
+		   if (relocs[i].cell >= header->numCells || relocs[i].offset < 0 || relocs[i].offset >= arrayBytes) {
+			   llvm::errs() << path << " relocates a global outside its data segment\n";
+			   exit(0);
+		   }
+		   segment.set(relocs[i].cell, segment.arrayAddress(relocs[i].offset));
+	   }
+
+	   module.functions.resize(header->numFunctions);
+	   for (uint32_t i = 0; i < header->numFunctions; i++) {
+		   const ImageFunction & image = functions[i];
+		   if (image.firstConst > header->numConsts || image.numConsts > header->numConsts - image.firstConst
+				   || image.firstInstr > header->numInstrs || image.numInstrs > header->numInstrs - image.firstInstr) {
+			   llvm::errs() << path << " is truncated\n";
+			   exit(0);
+		   }
+		   BcFunction & fn = module.functions[i];
+		   fn.decl = NULL;
+		   fn.numParams = image.numParams;
+		   fn.numRegs = image.numRegs;
+		   fn.consts.assign(consts + image.firstConst, consts + image.firstConst + image.numConsts);
+		   fn.code.assign(code + image.firstInstr, code + image.firstInstr + image.numInstrs);
+	   }
+	   for (uint32_t i = 0; i < header->numFunctions; i++)
+		   if (!valid(module, i, header->numCells)) {
+			   llvm::errs() << path << " has an invalid instruction in function " << i << "\n";
+			   exit(0);
+		   }
+	   module.entry = header->entry;
+	   munmap(map, size);
+   }
+
+private:
+   /// Whether every operand of function index of module is in range: registers
+   /// of its frame, its constants, its code, the cells of the globals and the
+   /// functions of module, so that the VM never reads or jumps outside them.
+   /// The code must end in a return or a jump, the VM does not check for its end.
+   static bool valid(const BcModule & module, uint32_t index, uint32_t numCells) {
+	   const BcFunction & fn = module.functions[index];
+	   if (fn.numParams > fn.numRegs || fn.code.empty())
+		   return false;
+	   Opcode last = fn.code.back().op;
+	   if (last != BC_Ret && last != BC_RetVoid && last != BC_Jmp)
+		   return false;
+	   auto reg = [&](int32_t r) { return r >= 0 && (uint32_t)r < fn.numRegs; };
+	   auto constant = [&](int32_t k) { return k >= 0 && (size_t)k < fn.consts.size(); };
+	   auto target = [&](int32_t pc) { return pc >= 0 && (size_t)pc < fn.code.size(); };
+	   auto cell = [&](int32_t c) { return c >= 0 && (uint32_t)c < numCells; };
+	   for (const Instr & i : fn.code) {
+		   bool ok;
+		   switch (i.op) {
+		   case BC_LoadK: case BC_Alloca: ok = reg(i.a) && constant(i.b); break;
+		   case BC_LoadG: ok = reg(i.a) && cell(i.b); break;
+		   case BC_StoreG: ok = cell(i.a) && reg(i.b); break;
+		   case BC_Mov: case BC_Neg: case BC_Load64: case BC_Load8: case BC_Store64: case BC_Store8:
+		   case BC_Malloc:
+			   ok = reg(i.a) && reg(i.b);
+			   break;
+		   case BC_Add: case BC_Sub: case BC_Mul: case BC_Div: case BC_LT: case BC_GT: case BC_EQ:
+		   case BC_PtrAdd: case BC_Index64: case BC_Index8: case BC_StIndex64: case BC_StIndex8:
+			   ok = reg(i.a) && reg(i.b) && reg(i.c);
+			   break;
+		   case BC_Mark: case BC_Release: case BC_Ret: case BC_Get: case BC_Print: case BC_Free:
+			   ok = reg(i.a);
+			   break;
+		   case BC_RetVoid: ok = true; break;
+		   case BC_Jmp: ok = target(i.b); break;
+		   case BC_Jz: ok = reg(i.a) && target(i.b); break;
+		   case BC_Call:
+			   /// the arguments are the first registers of the callee frame at c
+			   ok = reg(i.a) && i.b >= 0 && (size_t)i.b < module.functions.size() && i.c >= 0
+				   && (uint64_t)i.c + module.functions[i.b].numParams <= fn.numRegs;
+			   break;
+		   default: ok = false; break;
+		   }
+		   if (!ok)
+			   return false;
+	   }
+	   return true;
+   }
+};
+
+constexpr char ProgramImage::Magic[8];
+
+#endif
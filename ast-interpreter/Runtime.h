@@ -0,0 +1,60 @@
+//==--- Runtime.h - Callbacks of natively compiled guest code -------------===//
+//===----------------------------------------------------------------------===//
+#ifndef _RUNTIME_H_
+#define _RUNTIME_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+#include "Environment.h"
+
+/// What native code cannot do inline calls back here, so that every tier
+/// shares the guest heap, the stack region and the messages of the
+/// interpreter
+struct Runtime {
+   static int64_t get(Environment * env) {
+	   return env->input();
+   }
+   static void print(Environment * env, int64_t val) {
+	   env->output(val);
+   }
+   static int64_t malloc(Environment * env, int64_t size) {
+	   return env->allocate(size);
+   }
+   static void free(Environment * env, int64_t addr) {
+	   env->deallocate(addr);
+   }
+   static int64_t stackAllocate(Environment * env, int64_t size) {
+	   return env->getStackRegion().allocate(size);
+   }
+   static int64_t mark(Environment * env) {
+	   return env->getStackRegion().mark();
+   }
+   static void release(Environment * env, int64_t mark) {
+	   env->getStackRegion().release(mark);
+   }
+   static void divZero() {
+	   llvm::errs() << "div 0 errs\n";
+	   exit(0);
+   }
+   static void overflow() {
+	   llvm::errs() << "stack overflow\n";
+	   exit(0);
+   }
+
+   /// Headroom kept on the host stack for the runtime calls of native code
+   static constexpr size_t StackSlack = 256 << 10;
+
+   /// Native code reports a stack overflow below the returned address.
+   /// Called near the bottom of the host stack, e.g. from the ASTConsumer.
+   static uintptr_t stackLimit() {
+	   struct rlimit limit;
+	   size_t stack = 8 << 20;
+	   if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+		   stack = limit.rlim_cur;
+	   return (uintptr_t)__builtin_frame_address(0) - stack + StackSlack;
+   }
+};
+
+#endif
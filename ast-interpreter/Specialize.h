@@ -0,0 +1,525 @@
+//==--- Specialize.h - Ahead-of-time translation to C++ and its cache ------===//
+//===----------------------------------------------------------------------===//
+#ifndef _SPECIALIZE_H_
+#define _SPECIALIZE_H_
+
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Environment.h"
+
+/// Built-ins of the translated program, with the messages of Environment
+static const char * SpecializedPrelude =
+	"#include <stdint.h>\n"
+	"#include <stdio.h>\n"
+	"#include <stdlib.h>\n"
+	"\n"
+	"static int64_t rt_get() {\n"
+	"\tint64_t val = 0;\n"
+	"\tfprintf(stderr, \"Please Input an Integer Value : \");\n"
+	"\tif (scanf(\"%ld\", &val) != 1)\n"
+	"\t\tval = 0;\n"
+	"\treturn val;\n"
+	"}\n"
+	"static void rt_print(int64_t val) {\n"
+	"\tfprintf(stderr, \"%ld\\n\", val);\n"
+	"}\n"
+	"static int64_t rt_malloc(int64_t size) {\n"
+	"\tif (size < 0) {\n"
+	"\t\tfprintf(stderr, \"invalid malloc size %ld\\n\", size);\n"
+	"\t\texit(0);\n"
+	"\t}\n"
+	"\treturn (int64_t)malloc(size == 0 ? 1 : size);\n"
+	"}\n"
+	"static void rt_free(int64_t addr) {\n"
+	"\tfree((void *)addr);\n"
+	"}\n"
+	"static int64_t rt_div(int64_t lhs, int64_t rhs) {\n"
+	"\tif (rhs == 0) {\n"
+	"\t\tfprintf(stderr, \"div 0 errs\\n\");\n"
+	"\t\texit(0);\n"
+	"\t}\n"
+	"\treturn lhs / rhs;\n"
+	"}\n";
+
+/// Translates a translation unit into a standalone C++ program after
+/// Environment::init. Every guest value is an int64_t: the frame of a
+/// function becomes its locals l0..lN, mirroring the FrameLayout slots, and
+/// the globals are the DataSegment image, array storage included. Every
+/// sub-expression is evaluated into a temporary of its own, so the operands
+/// keep the left to right order of the interpreter.
+class Specializer {
+   Environment * mEnv;
+   FrameLayout & mLayout;
+   std::string mText;
+   llvm::raw_string_ostream mOut;
+
+   /// State of the function being translated
+   std::string mBodyText;
+   llvm::raw_string_ostream mBody;
+   unsigned mTemps;
+   unsigned mArrays;
+   unsigned mLabels;
+   unsigned mDepth;
+   /// Label ending the body of each enclosing loop
+   std::vector<unsigned> mContinues;
+public:
+   /// Part of the cache key, bump it whenever the generated code changes
+   static constexpr unsigned Version = 1;
+
+   explicit Specializer(Environment * env) : mEnv(env), mLayout(env->getLayout()), mText(), mOut(mText),
+	   mBodyText(), mBody(mBodyText), mTemps(0), mArrays(0), mLabels(0), mDepth(0), mContinues() {
+   }
+
+   std::string emit(TranslationUnitDecl * unit) {
+	   mOut << SpecializedPrelude << "\n";
+	   emitData(unit);
+	   for (Decl * decl : unit->decls())
+		   if (FunctionDecl * fdecl = dyn_cast<FunctionDecl>(decl))
+			   if (fdecl->doesThisDeclarationHaveABody())
+				   mOut << "static int64_t " << signature(fdecl) << ";\n";
+	   mOut << "\n";
+	   for (Decl * decl : unit->decls())
+		   if (FunctionDecl * fdecl = dyn_cast<FunctionDecl>(decl))
+			   if (fdecl->doesThisDeclarationHaveABody())
+				   emitFunction(fdecl);
+	   mOut << "extern \"C\" int64_t guest_main() {\n";
+	   mOut << "\trelocate();\n";
+	   mOut << "\treturn f" << mLayout.getFunction(mEnv->getEntry()).index << "();\n";
+	   mOut << "}\n";
+	   return mOut.str();
+   }
+
+private:
+   /// The DataSegment after init; cells holding the address of a global
+   /// array are rebased onto the copy in the program
+   void emitData(TranslationUnitDecl * unit) {
+	   DataSegment & data = mEnv->getDataSegment();
+	   unsigned numCells = mLayout.getNumGlobals();
+	   mOut << "static int64_t data[" << std::max<size_t>(data.size(), 1) << "] = {";
+	   for (size_t i = 0; i < data.size(); i++)
+		   mOut << (i ? ", " : "") << data.cells()[i];
+	   mOut << "};\n";
+	   mOut << "static void relocate() {\n";
+	   for (Decl * decl : unit->decls())
+		   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl))
+			   if (isa<ConstantArrayType>(vardecl->getType().getTypePtr())) {
+				   unsigned idx = mLayout.getSlot(vardecl).index;
+				   int64_t offset = data.get(idx) - data.arrayAddress(0);
+				   mOut << "\tdata[" << idx << "] = (int64_t)(data + " << numCells << ") + " << offset << ";\n";
+			   }
+	   mOut << "}\n\n";
+   }
+
+   std::string signature(FunctionDecl * fdecl) {
+	   const FunctionLayout & layout = mLayout.getFunction(fdecl);
+	   std::string sig = "f" + std::to_string(layout.index) + "(";
+	   for (unsigned i = 0; i < layout.numParams; i++)
+		   sig += (i ? ", int64_t l" : "int64_t l") + std::to_string(i);
+	   return sig + ")";
+   }
+
+   void emitFunction(FunctionDecl * fdecl) {
+	   const FunctionLayout & layout = mLayout.getFunction(fdecl);
+	   mBodyText.clear();
+	   mTemps = 0;
+	   mArrays = 0;
+	   mLabels = 0;
+	   mDepth = 1;
+	   emitStmt(fdecl->getBody());
+	   mBody.flush();
+
+	   mOut << "static int64_t " << signature(fdecl) << " {\n";
+	   for (unsigned i = layout.numParams; i < layout.numSlots; i++)
+		   mOut << "\tint64_t l" << i << " = 0;\n";
+	   for (unsigned i = 0; i < mTemps; i++)
+		   mOut << "\tint64_t t" << i << ";\n";
+	   mOut << mBodyText << "\treturn 0;\n}\n\n";
+   }
+
+   llvm::raw_ostream & line() {
+	   for (unsigned i = 0; i < mDepth; i++)
+		   mBody << "\t";
+	   return mBody;
+   }
+   std::string newTemp() {
+	   return "t" + std::to_string(mTemps++);
+   }
+   std::string var(VarDecl * vardecl) {
+	   const VarSlot & slot = mLayout.getSlot(vardecl);
+	   return (slot.global ? "data[" + std::to_string(slot.index) + "]" : "l" + std::to_string(slot.index));
+   }
+   static bool isCharElement(QualType type) {
+	   return type->isCharType();
+   }
+
+   void emitStmt(Stmt * stmt) {
+	   if (!stmt)
+		   return;
+	   if (CompoundStmt * compound = dyn_cast<CompoundStmt>(stmt)) {
+		   line() << "{\n";
+		   mDepth++;
+		   for (Stmt * child : compound->body())
+			   emitStmt(child);
+		   mDepth--;
+		   line() << "}\n";
+	   } else if (DeclStmt * declstmt = dyn_cast<DeclStmt>(stmt)) {
+		   for (Decl * decl : declstmt->decls())
+			   if (VarDecl * vardecl = dyn_cast<VarDecl>(decl))
+				   emitVarDecl(vardecl);
+	   } else if (IfStmt * ifstmt = dyn_cast<IfStmt>(stmt)) {
+		   std::string cond = emitExpr(ifstmt->getCond());
+		   line() << "if (" << cond << ") {\n";
+		   mDepth++;
+		   emitStmt(ifstmt->getThen());
+		   mDepth--;
+		   if (ifstmt->getElse()) {
+			   line() << "} else {\n";
+			   mDepth++;
+			   emitStmt(ifstmt->getElse());
+			   mDepth--;
+		   }
+		   line() << "}\n";
+	   } else if (WhileStmt * wstmt = dyn_cast<WhileStmt>(stmt)) {
+		   emitLoop(wstmt->getCond(), wstmt->getBody(), NULL);
+	   } else if (ForStmt * fstmt = dyn_cast<ForStmt>(stmt)) {
+		   line() << "{\n";
+		   mDepth++;
+		   emitStmt(fstmt->getInit());
+		   emitLoop(fstmt->getCond(), fstmt->getBody(), fstmt->getInc());
+		   mDepth--;
+		   line() << "}\n";
+	   } else if (ReturnStmt * rstmt = dyn_cast<ReturnStmt>(stmt)) {
+		   if (rstmt->getRetValue()) {
+			   std::string val = emitExpr(rstmt->getRetValue());
+			   line() << "return " << val << ";\n";
+		   } else
+			   line() << "return 0;\n";
+	   } else if (isa<BreakStmt>(stmt)) {
+		   line() << "break;\n";
+	   } else if (isa<ContinueStmt>(stmt)) {
+		   assert(!mContinues.empty() && "continue outside of a loop");
+		   line() << "goto c" << mContinues.back() << ";\n";
+	   } else if (isa<NullStmt>(stmt)) {
+	   } else if (Expr * expr = dyn_cast<Expr>(stmt)) {
+		   emitExpr(expr);
+	   } else {
+		   llvm::errs() << "can not specialize this Stmt\n";
+		   exit(0);
+	   }
+   }
+
+   /// The condition is tested inside the loop so that it can be any
+   /// sequence of statements; a continue jumps past the body, to inc
+   void emitLoop(Expr * cond, Stmt * body, Expr * inc) {
+	   unsigned label = mLabels++;
+	   line() << "for (;;) {\n";
+	   mDepth++;
+	   if (cond) {
+		   std::string val = emitExpr(cond);
+		   line() << "if (!" << val << ")\n";
+		   line() << "\tbreak;\n";
+	   }
+	   line() << "{\n";
+	   mDepth++;
+	   mContinues.push_back(label);
+	   emitStmt(body);
+	   mContinues.pop_back();
+	   mDepth--;
+	   line() << "}\n";
+	   line() << "c" << label << ":;\n";
+	   if (inc)
+		   emitExpr(inc);
+	   mDepth--;
+	   line() << "}\n";
+   }
+
+   /// A local array is zeroed storage of the enclosing block
+   void emitVarDecl(VarDecl * vardecl) {
+	   const Type * type = vardecl->getType().getTypePtr();
+	   if (auto carray = dyn_cast<ConstantArrayType>(type)) {
+		   int64_t size = carray->getSize().getSExtValue();
+		   int64_t width = isCharElement(carray->getElementType()) ? 1 : 8;
+		   unsigned array = mArrays++;
+		   line() << "alignas(16) char a" << array << "[" << std::max<int64_t>(size * width, 1) << "] = {};\n";
+		   line() << var(vardecl) << " = (int64_t)a" << array << ";\n";
+	   } else if (vardecl->hasInit()) {
+		   std::string val = emitExpr(vardecl->getInit());
+		   line() << var(vardecl) << " = " << val << ";\n";
+	   } else {
+		   line() << var(vardecl) << " = 0;\n";
+	   }
+   }
+
+   /// Emit the statements evaluating expr and return a temporary or a
+   /// literal holding its value
+   std::string emitExpr(Expr * expr) {
+	   if (IntegerLiteral * intlt = dyn_cast<IntegerLiteral>(expr)) {
+		   return "INT64_C(" + std::to_string(intlt->getValue().getSExtValue()) + ")";
+	   } else if (CharacterLiteral * charlt = dyn_cast<CharacterLiteral>(expr)) {
+		   return std::to_string((int64_t)charlt->getValue());
+	   } else if (ParenExpr * pe = dyn_cast<ParenExpr>(expr)) {
+		   return emitExpr(pe->getSubExpr());
+	   } else if (CastExpr * castexpr = dyn_cast<CastExpr>(expr)) {
+		   return emitExpr(castexpr->getSubExpr());
+	   } else if (DeclRefExpr * declref = dyn_cast<DeclRefExpr>(expr)) {
+		   VarDecl * vardecl = dyn_cast<VarDecl>(declref->getDecl());
+		   if (!vardecl) {
+			   llvm::errs() << "can not specialize this DeclRefExpr\n";
+			   exit(0);
+		   }
+		   return assign(var(vardecl));
+	   } else if (UnaryExprOrTypeTraitExpr * uette = dyn_cast<UnaryExprOrTypeTraitExpr>(expr)) {
+		   if (uette->getKind() != UETT_SizeOf) {
+			   llvm::errs() << "can not specialize this UnaryExprOrTypeTraitExpr\n";
+			   exit(0);
+		   }
+		   return isCharElement(uette->getTypeOfArgument()) ? "1" : "8";
+	   } else if (UnaryOperator * uop = dyn_cast<UnaryOperator>(expr)) {
+		   return emitUnary(uop);
+	   } else if (ArraySubscriptExpr * ase = dyn_cast<ArraySubscriptExpr>(expr)) {
+		   std::string base = emitExpr(ase->getBase());
+		   std::string idx = emitExpr(ase->getIdx());
+		   return assign(element(ase->getType(), base, idx));
+	   } else if (BinaryOperator * bop = dyn_cast<BinaryOperator>(expr)) {
+		   if (bop->isAssignmentOp())
+			   return emitAssign(bop);
+		   return emitBinary(bop);
+	   } else if (CallExpr * call = dyn_cast<CallExpr>(expr)) {
+		   return emitCall(call);
+	   }
+	   llvm::errs() << "can not specialize this Expr\n";
+	   exit(0);
+   }
+
+   std::string assign(const std::string & val) {
+	   std::string temp = newTemp();
+	   line() << temp << " = " << val << ";\n";
+	   return temp;
+   }
+   static std::string element(QualType type, const std::string & base, const std::string & idx) {
+	   if (isCharElement(type))
+		   return "*(char *)(" + base + " + " + idx + ")";
+	   return "*(int64_t *)(" + base + " + 8 * " + idx + ")";
+   }
+   static std::string deref(QualType type, const std::string & ptr) {
+	   return (isCharElement(type) ? "*(char *)" : "*(int64_t *)") + ptr;
+   }
+
+   std::string emitUnary(UnaryOperator * uop) {
+	   Expr * sub = uop->getSubExpr();
+	   switch (uop->getOpcode()) {
+		   case UO_Plus:
+			   return emitExpr(sub);
+		   case UO_Minus:
+			   return assign("-" + emitExpr(sub));
+		   case UO_Deref:
+			   return assign(deref(uop->getType(), emitExpr(sub)));
+		   default:
+			   llvm::errs() << "can not process this UOp\n";
+			   exit(0);
+	   }
+   }
+
+   std::string emitBinary(BinaryOperator * bop) {
+	   Expr * left = bop->getLHS();
+	   std::string lhs = emitExpr(left);
+	   std::string rhs = emitExpr(bop->getRHS());
+	   switch (bop->getOpcode()) {
+		   case BO_Add:
+			   if (left->getType()->isPointerType() &&
+					   !isCharElement(left->getType()->getPointeeType()))
+				   return assign(lhs + " + 8 * " + rhs);
+			   return assign(lhs + " + " + rhs);
+		   case BO_Sub: return assign(lhs + " - " + rhs);
+		   case BO_Mul: return assign(lhs + " * " + rhs);
+		   case BO_Div: return assign("rt_div(" + lhs + ", " + rhs + ")");
+		   case BO_LT: return assign("(int64_t)(" + lhs + " < " + rhs + ")");
+		   case BO_GT: return assign("(int64_t)(" + lhs + " > " + rhs + ")");
+		   case BO_EQ: return assign("(int64_t)(" + lhs + " == " + rhs + ")");
+		   default:
+			   llvm::errs() << "can not process this Op\n";
+			   exit(0);
+	   }
+   }
+
+   std::string emitAssign(BinaryOperator * bop) {
+	   if (bop->getOpcode() != BO_Assign) {
+		   llvm::errs() << "can not process this Op\n";
+		   exit(0);
+	   }
+	   Expr * left = bop->getLHS()->IgnoreParens();
+	   Expr * right = bop->getRHS();
+	   if (DeclRefExpr * declref = dyn_cast<DeclRefExpr>(left)) {
+		   std::string val = emitExpr(right);
+		   line() << var(cast<VarDecl>(declref->getDecl())) << " = " << val << ";\n";
+		   return val;
+	   } else if (ArraySubscriptExpr * ase = dyn_cast<ArraySubscriptExpr>(left)) {
+		   std::string base = emitExpr(ase->getBase());
+		   std::string idx = emitExpr(ase->getIdx());
+		   std::string val = emitExpr(right);
+		   line() << element(ase->getType(), base, idx) << " = " << val << ";\n";
+		   return val;
+	   } else if (UnaryOperator * uop = dyn_cast<UnaryOperator>(left)) {
+		   if (uop->getOpcode() == UO_Deref) {
+			   std::string ptr = emitExpr(uop->getSubExpr());
+			   std::string val = emitExpr(right);
+			   line() << deref(uop->getType(), ptr) << " = " << val << ";\n";
+			   return val;
+		   }
+	   }
+	   llvm::errs() << "can not assign to this Expr\n";
+	   exit(0);
+   }
+
+   std::string emitCall(CallExpr * call) {
+	   const CallTarget & callee = mEnv->getCalls().lookup(call);
+	   switch (callee.kind) {
+		   case Call_Get:
+			   return assign("rt_get()");
+		   case Call_Print: {
+			   // the argument emits its own lines before the call's
+			   std::string val = emitExpr(call->getArg(0));
+			   line() << "rt_print(" << val << ");\n";
+			   return "0";
+		   }
+		   case Call_Malloc:
+			   return assign("rt_malloc(" + emitExpr(call->getArg(0)) + ")");
+		   case Call_Free: {
+			   std::string ptr = emitExpr(call->getArg(0));
+			   line() << "rt_free(" << ptr << ");\n";
+			   return "0";
+		   }
+		   case Call_User:
+			   break;
+	   }
+	   if (!callee.def) {
+		   llvm::errs() << "can not find the body of " << call->getDirectCallee()->getName() << "\n";
+		   exit(0);
+	   }
+	   std::string args;
+	   for (unsigned i = 0; i < call->getNumArgs(); i++)
+		   args += (i ? ", " : "") + emitExpr(call->getArg(i));
+	   return assign("f" + std::to_string(callee.index) + "(" + args + ")");
+   }
+};
+
+/// Entry point exported by a specialized program
+typedef int64_t (*SpecializedMain)();
+
+/// Shared objects of specialized programs, keyed by the MD5 of the guest
+/// source, so that a cached program runs without parsing it again
+class ProgramCache {
+   std::string mDir;
+   std::string mKey;
+public:
+   /// An empty dir selects the user cache directory, or a directory of the
+   /// user under the shared temporary one
+   ProgramCache(llvm::StringRef dir, llvm::StringRef source) : mDir(dir), mKey() {
+	   if (mDir.empty()) {
+		   llvm::SmallString<128> path;
+		   if (llvm::sys::path::cache_directory(path)) {
+			   llvm::sys::path::append(path, "ast-interpreter");
+		   } else {
+			   llvm::sys::path::system_temp_directory(true, path);
+			   llvm::sys::path::append(path, "ast-interpreter-" + std::to_string(getuid()));
+		   }
+		   mDir = path.str().str();
+	   }
+	   llvm::MD5 md5;
+	   md5.update(std::to_string(Specializer::Version));
+	   md5.update(source);
+	   llvm::MD5::MD5Result hash;
+	   md5.final(hash);
+	   mKey = hash.digest().str().str();
+   }
+
+   /// The cached program, NULL when there is none. Only an object that the
+   /// user owns, in a directory only the user can write, is loaded.
+   SpecializedMain load() {
+	   std::string object = path(".so");
+	   if (!llvm::sys::fs::exists(object))
+		   return NULL;
+	   if (!privateTo(mDir, llvm::sys::fs::file_type::directory_file) ||
+			   !privateTo(object, llvm::sys::fs::file_type::regular_file))
+		   return fail("not loading " + object + ", it may have been written by another user");
+	   std::string err;
+	   llvm::sys::DynamicLibrary lib = llvm::sys::DynamicLibrary::getPermanentLibrary(object.c_str(), &err);
+	   if (!lib.isValid())
+		   return NULL;
+	   return (SpecializedMain)lib.getAddressOfSymbol("guest_main");
+   }
+
+   /// Compile source with the system compiler ($CXX or c++) into the cache.
+   /// The object is renamed into place once complete, so concurrent runs
+   /// never load a partial one.
+   SpecializedMain build(const std::string & source) {
+	   if (llvm::sys::fs::create_directories(mDir, true, llvm::sys::fs::owner_all))
+		   return fail("can not create " + mDir);
+	   /// a directory of the user from before is made private
+	   llvm::sys::fs::file_status status;
+	   if (!llvm::sys::fs::status(mDir, status, false) && status.getUser() == getuid() &&
+			   status.type() == llvm::sys::fs::file_type::directory_file)
+		   llvm::sys::fs::setPermissions(mDir, llvm::sys::fs::owner_all);
+	   if (!privateTo(mDir, llvm::sys::fs::file_type::directory_file))
+		   return fail(mDir + " is not a directory private to the user");
+	   std::string cpp = path(".cpp");
+	   std::error_code ec;
+	   {
+		   llvm::raw_fd_ostream out(cpp, ec);
+		   if (ec)
+			   return fail("can not write " + cpp);
+		   out << source;
+	   }
+	   std::string compiler = "c++";
+	   if (llvm::Optional<std::string> cxx = llvm::sys::Process::GetEnv("CXX"))
+		   compiler = *cxx;
+	   llvm::ErrorOr<std::string> program = llvm::sys::findProgramByName(compiler);
+	   if (!program)
+		   return fail("can not find the compiler " + compiler);
+	   std::string tmp = path(".so.tmp" + std::to_string(llvm::sys::Process::getProcessId()));
+	   llvm::StringRef args[] = { *program, "-std=c++11", "-O2", "-w", "-shared", "-fPIC", "-o", tmp, cpp };
+	   if (llvm::sys::ExecuteAndWait(*program, args) != 0)
+		   return fail("can not compile " + cpp);
+	   if (llvm::sys::fs::rename(tmp, path(".so")))
+		   return fail("can not write " + path(".so"));
+	   return load();
+   }
+
+private:
+   /// Whether path, not followed if it is a link, is a type owned by the
+   /// user that nobody else can write. A directory must be mode 0700.
+   static bool privateTo(const std::string & path, llvm::sys::fs::file_type type) {
+	   llvm::sys::fs::file_status status;
+	   if (llvm::sys::fs::status(path, status, false) || status.type() != type || status.getUser() != getuid())
+		   return false;
+	   llvm::sys::fs::perms others = type == llvm::sys::fs::file_type::directory_file ?
+		   (llvm::sys::fs::perms)(llvm::sys::fs::group_all | llvm::sys::fs::others_all) :
+		   (llvm::sys::fs::perms)(llvm::sys::fs::group_write | llvm::sys::fs::others_write);
+	   return (status.permissions() & others) == 0;
+   }
+   std::string path(const std::string & ext) {
+	   llvm::SmallString<128> file(mDir);
+	   llvm::sys::path::append(file, mKey + ext);
+	   return file.str().str();
+   }
+   SpecializedMain fail(const std::string & msg) {
+	   llvm::errs() << msg << "\n";
+	   return NULL;
+   }
+};
+
+#endif
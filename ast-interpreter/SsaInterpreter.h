@@ -0,0 +1,657 @@
+//==--- SsaInterpreter.h - Interpreter for Clang CodeGen SSA IR -----------===//
+//===----------------------------------------------------------------------===//
+#ifndef _SSAINTERPRETER_H_
+#define _SSAINTERPRETER_H_
+
+#include <string.h>
+#include <memory>
+#include <vector>
+
+#include "clang/CodeGen/CodeGenAction.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/GetElementPtrTypeIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Pass.h"
+#include "llvm/Transforms/Utils.h"
+
+#include "Environment.h"
+
+/// Pre-decoded operations. Operands are slots of the frame; an integer
+/// narrower than 64 bits is kept sign-extended, shift = 64 - its width
+/// restores that form after an operation.
+enum IrOpcode : uint8_t {
+   IR_Mov,		/// a <- b
+   IR_Add,		/// a <- b + c
+   IR_Sub,
+   IR_Mul,
+   IR_SDiv,
+   IR_SRem,
+   IR_UDiv,
+   IR_URem,
+   IR_Shl,
+   IR_LShr,
+   IR_AShr,
+   IR_And,
+   IR_Or,
+   IR_Xor,
+   IR_Eq,		/// a <- b == c
+   IR_Ne,
+   IR_Slt,
+   IR_Sle,
+   IR_Sgt,
+   IR_Sge,
+   IR_Ult,		/// a <- b < c, both zero-extended from shift
+   IR_Ule,
+   IR_Ugt,
+   IR_Uge,
+   IR_Trunc,		/// a <- b, sign-extended from shift
+   IR_ZExt,		/// a <- b, zero-extended from shift
+   IR_Select,		/// a <- b ? c : slot imm
+   IR_Load8,		/// a <- *(int8_t *)b
+   IR_Load16,
+   IR_Load32,
+   IR_Load64,
+   IR_Store8,		/// *(int8_t *)a <- b
+   IR_Store16,
+   IR_Store32,
+   IR_Store64,
+   IR_Gep,		/// a <- b + imm
+   IR_GepIdx,		/// a <- a + c * imm
+   IR_Alloca,		/// a <- zeroed stack block of imm bytes
+   IR_Memset,		/// memset(a, b, c)
+   IR_Memcpy,		/// memmove(a, b, c)
+   IR_Br,		/// pc <- imm
+   IR_CondBr,		/// pc <- a ? b : c
+   IR_Call,		/// a <- functions[b](args[c .. c + imm])
+   IR_Ret,		/// return a
+   IR_RetVoid,
+   IR_Get,		/// a <- GET()
+   IR_Print,		/// PRINT(a)
+   IR_Malloc,		/// a <- MALLOC(b)
+   IR_Free,		/// FREE(a)
+   IR_Unreachable
+};
+
+struct IrInstr {
+   IrOpcode op;
+   uint8_t shift;
+   int32_t a;
+   int32_t b;
+   int32_t c;
+   int64_t imm;
+};
+
+/// A decoded function. Slots 0..numArgs-1 are the arguments, every other
+/// SSA value follows, then the constants, copied from consts on entry, then
+/// the temporaries of the phi moves.
+struct IrFunction {
+   unsigned numArgs;
+   unsigned numSlots;
+   unsigned constBase;
+   std::vector<int64_t> consts;
+   std::vector<IrInstr> code;
+};
+
+/// Runs the IR of Clang CodeGen after mem2reg. Each llvm::Function is
+/// decoded once into a dense array of IrInstr whose operands are frame
+/// slots: an SSA value is a slot, so executing an instruction never looks
+/// a value up. Phi nodes become moves on the edges leading to their block.
+/// Guest calls push a frame instead of recursing on the host stack, local
+/// arrays are carved from a StackRegion and MALLOC/FREE use the guest Heap.
+class SsaInterpreter {
+   struct Frame {
+	   const IrFunction * fn;
+	   const IrInstr * ret;
+	   int64_t * base;
+	   int32_t dst;
+	   size_t mark;
+   };
+   /// A branch whose target is known once every block is laid out
+   struct Edge {
+	   unsigned pc;
+	   bool taken;
+	   const llvm::BasicBlock * from;
+	   const llvm::BasicBlock * to;
+   };
+
+   llvm::Module & mModule;
+   const llvm::DataLayout & mLayout;
+   std::vector<IrFunction> mFunctions;
+   llvm::DenseMap<const llvm::Function *, unsigned> mFunctionIndex;
+   std::vector<int32_t> mArgs;
+   std::vector<char> mGlobals;
+   llvm::DenseMap<const llvm::GlobalVariable *, int64_t> mGlobalAddress;
+   Reservation mRegs;
+   StackRegion mRegion;
+   Heap mHeap;
+   std::vector<Frame> mFrames;
+
+   /// State of the function being decoded
+   IrFunction * mFn;
+   llvm::DenseMap<const llvm::Value *, int32_t> mSlots;
+   llvm::DenseMap<const llvm::BasicBlock *, unsigned> mBlockStart;
+   std::vector<Edge> mEdges;
+public:
+   SsaInterpreter(llvm::Module & module, size_t stackBudget)
+   : mModule(module), mLayout(module.getDataLayout()), mFunctions(), mFunctionIndex(), mArgs(), mGlobals(),
+	   mGlobalAddress(), mRegs(stackBudget, "register file"), mRegion(stackBudget), mHeap(), mFrames(),
+	   mFn(NULL), mSlots(), mBlockStart(), mEdges() {
+   }
+
+   /// mem2reg needs functions without optnone, which CodeGen adds at -O0
+   static void promote(llvm::Module & module) {
+	   llvm::legacy::FunctionPassManager passes(&module);
+	   passes.add(llvm::createPromoteMemoryToRegisterPass());
+	   passes.doInitialization();
+	   for (llvm::Function & function : module) {
+		   function.removeFnAttr(llvm::Attribute::OptimizeNone);
+		   if (!function.isDeclaration())
+			   passes.run(function);
+	   }
+	   passes.doFinalization();
+   }
+
+   int64_t run() {
+	   layoutGlobals();
+	   for (llvm::Function & function : mModule)
+		   if (!function.isDeclaration()) {
+			   mFunctionIndex[&function] = mFunctions.size();
+			   mFunctions.push_back(IrFunction());
+		   }
+	   for (llvm::Function & function : mModule)
+		   if (!function.isDeclaration())
+			   decode(function, &mFunctions[mFunctionIndex[&function]]);
+	   llvm::Function * main = mModule.getFunction("main");
+	   if (!main || main->isDeclaration()) {
+		   llvm::errs() << "can not find the body of main\n";
+		   exit(0);
+	   }
+	   return execute(&mFunctions[mFunctionIndex[main]]);
+   }
+
+private:
+   void layoutGlobals() {
+	   size_t size = 0;
+	   for (llvm::GlobalVariable & global : mModule.globals()) {
+		   size_t align = std::max<size_t>(mLayout.getPreferredAlignment(&global), 8);
+		   size = (size + align - 1) / align * align;
+		   mGlobalAddress[&global] = size;
+		   size += mLayout.getTypeAllocSize(global.getValueType());
+	   }
+	   mGlobals.assign(size + 16, 0);
+	   char * base = (char *)(((uintptr_t)mGlobals.data() + 15) & ~(uintptr_t)15);
+	   for (llvm::GlobalVariable & global : mModule.globals())
+		   mGlobalAddress[&global] += (int64_t)base;
+	   for (llvm::GlobalVariable & global : mModule.globals())
+		   if (global.hasInitializer())
+			   initialize(global.getInitializer(), (char *)mGlobalAddress[&global]);
+   }
+
+   void initialize(const llvm::Constant * init, char * addr) {
+	   llvm::Type * type = init->getType();
+	   if (init->isNullValue() || llvm::isa<llvm::UndefValue>(init))
+		   return;
+	   if (auto data = llvm::dyn_cast<llvm::ConstantDataSequential>(init)) {
+		   llvm::StringRef raw = data->getRawDataValues();
+		   memcpy(addr, raw.data(), raw.size());
+	   } else if (auto stype = llvm::dyn_cast<llvm::StructType>(type)) {
+		   const llvm::StructLayout * layout = mLayout.getStructLayout(stype);
+		   for (unsigned i = 0; i < init->getNumOperands(); i++)
+			   initialize(llvm::cast<llvm::Constant>(init->getOperand(i)), addr + layout->getElementOffset(i));
+	   } else if (auto atype = llvm::dyn_cast<llvm::ArrayType>(type)) {
+		   uint64_t size = mLayout.getTypeAllocSize(atype->getElementType());
+		   for (unsigned i = 0; i < init->getNumOperands(); i++)
+			   initialize(llvm::cast<llvm::Constant>(init->getOperand(i)), addr + i * size);
+	   } else {
+		   int64_t val = constant(init);
+		   memcpy(addr, &val, mLayout.getTypeStoreSize(type));
+	   }
+   }
+
+   /// Value of a constant operand, addresses included
+   int64_t constant(const llvm::Constant * c) {
+	   if (auto ci = llvm::dyn_cast<llvm::ConstantInt>(c)) {
+		   if (ci->getBitWidth() > 64) {
+			   llvm::errs() << "can not process integers wider than 64 bits\n";
+			   exit(0);
+		   }
+		   return ci->getSExtValue();
+	   }
+	   if (c->isNullValue() || llvm::isa<llvm::UndefValue>(c))
+		   return 0;
+	   if (auto global = llvm::dyn_cast<llvm::GlobalVariable>(c))
+		   return mGlobalAddress[global];
+	   if (auto ce = llvm::dyn_cast<llvm::ConstantExpr>(c)) {
+		   if (ce->isCast())
+			   return constant(ce->getOperand(0));
+		   if (auto gep = llvm::dyn_cast<llvm::GEPOperator>(ce)) {
+			   llvm::APInt offset(64, 0);
+			   if (gep->accumulateConstantOffset(mLayout, offset))
+				   return constant(llvm::cast<llvm::Constant>(gep->getPointerOperand())) + offset.getSExtValue();
+		   }
+	   }
+	   llvm::errs() << "can not process this constant\n";
+	   exit(0);
+   }
+
+   int32_t slot(const llvm::Value * val) {
+	   auto found = mSlots.find(val);
+	   if (found != mSlots.end())
+		   return found->second;
+	   const llvm::Constant * c = llvm::dyn_cast<llvm::Constant>(val);
+	   if (!c) {
+		   llvm::errs() << "can not process this value\n";
+		   exit(0);
+	   }
+	   int32_t s = mFn->numSlots++;
+	   mFn->consts.push_back(constant(c));
+	   mSlots[val] = s;
+	   return s;
+   }
+   unsigned emit(IrOpcode op, int32_t a = 0, int32_t b = 0, int32_t c = 0, int64_t imm = 0, unsigned width = 64) {
+	   IrInstr i = { op, (uint8_t)(64 - width), a, b, c, imm };
+	   mFn->code.push_back(i);
+	   return mFn->code.size() - 1;
+   }
+   static unsigned width(llvm::Type * type) {
+	   return type->isIntegerTy() ? type->getIntegerBitWidth() : 64;
+   }
+
+   void decode(llvm::Function & function, IrFunction * fn) {
+	   mFn = fn;
+	   mSlots.clear();
+	   mBlockStart.clear();
+	   mEdges.clear();
+	   fn->numArgs = function.arg_size();
+	   fn->numSlots = fn->numArgs;
+	   for (llvm::Argument & arg : function.args())
+		   mSlots[&arg] = arg.getArgNo();
+	   for (llvm::BasicBlock & block : function)
+		   for (llvm::Instruction & inst : block)
+			   if (!inst.getType()->isVoidTy())
+				   mSlots[&inst] = fn->numSlots++;
+	   fn->constBase = fn->numSlots;
+	   for (llvm::BasicBlock & block : function) {
+		   mBlockStart[&block] = fn->code.size();
+		   for (llvm::Instruction & inst : block)
+			   decode(inst);
+	   }
+	   /// Every constant gets its slot before the first temporary
+	   std::vector<std::vector<std::pair<int32_t, int32_t>>> moves(mEdges.size());
+	   for (unsigned e = 0; e < mEdges.size(); e++)
+		   for (const llvm::PHINode & phi : mEdges[e].to->phis())
+			   moves[e].push_back(std::make_pair(mSlots[&phi], slot(phi.getIncomingValueForBlock(mEdges[e].from))));
+	   for (unsigned e = 0; e < mEdges.size(); e++)
+		   patchEdge(mEdges[e], moves[e]);
+	   mFn = NULL;
+   }
+
+   /// The moves of the phis of edge.to, a parallel copy, go on the edge
+   void patchEdge(const Edge & edge, const std::vector<std::pair<int32_t, int32_t>> & moves) {
+	   unsigned target = mBlockStart[edge.to];
+	   if (!moves.empty()) {
+		   bool overlap = false;
+		   for (auto & move : moves)
+			   for (auto & other : moves)
+				   overlap |= move.second == other.first && &move != &other;
+		   target = mFn->code.size();
+		   if (overlap) {
+			   std::vector<int32_t> temps;
+			   for (auto & move : moves) {
+				   temps.push_back(mFn->numSlots++);
+				   emit(IR_Mov, temps.back(), move.second);
+			   }
+			   for (unsigned i = 0; i < moves.size(); i++)
+				   emit(IR_Mov, moves[i].first, temps[i]);
+		   } else {
+			   for (auto & move : moves)
+				   emit(IR_Mov, move.first, move.second);
+		   }
+		   emit(IR_Br, 0, 0, 0, mBlockStart[edge.to]);
+	   }
+	   IrInstr & branch = mFn->code[edge.pc];
+	   if (branch.op == IR_Br)
+		   branch.imm = target;
+	   else if (edge.taken)
+		   branch.b = target;
+	   else
+		   branch.c = target;
+   }
+
+   void decode(llvm::Instruction & inst) {
+	   int32_t dst = inst.getType()->isVoidTy() ? -1 : mSlots[&inst];
+	   if (auto bin = llvm::dyn_cast<llvm::BinaryOperator>(&inst)) {
+		   IrOpcode op;
+		   switch (bin->getOpcode()) {
+			   case llvm::Instruction::Add: op = IR_Add; break;
+			   case llvm::Instruction::Sub: op = IR_Sub; break;
+			   case llvm::Instruction::Mul: op = IR_Mul; break;
+			   case llvm::Instruction::SDiv: op = IR_SDiv; break;
+			   case llvm::Instruction::SRem: op = IR_SRem; break;
+			   case llvm::Instruction::UDiv: op = IR_UDiv; break;
+			   case llvm::Instruction::URem: op = IR_URem; break;
+			   case llvm::Instruction::Shl: op = IR_Shl; break;
+			   case llvm::Instruction::LShr: op = IR_LShr; break;
+			   case llvm::Instruction::AShr: op = IR_AShr; break;
+			   case llvm::Instruction::And: op = IR_And; break;
+			   case llvm::Instruction::Or: op = IR_Or; break;
+			   case llvm::Instruction::Xor: op = IR_Xor; break;
+			   default:
+				   llvm::errs() << "can not process this Op\n";
+				   exit(0);
+		   }
+		   emit(op, dst, slot(bin->getOperand(0)), slot(bin->getOperand(1)), 0, width(bin->getType()));
+	   } else if (auto cmp = llvm::dyn_cast<llvm::ICmpInst>(&inst)) {
+		   IrOpcode op;
+		   switch (cmp->getPredicate()) {
+			   case llvm::CmpInst::ICMP_EQ: op = IR_Eq; break;
+			   case llvm::CmpInst::ICMP_NE: op = IR_Ne; break;
+			   case llvm::CmpInst::ICMP_SLT: op = IR_Slt; break;
+			   case llvm::CmpInst::ICMP_SLE: op = IR_Sle; break;
+			   case llvm::CmpInst::ICMP_SGT: op = IR_Sgt; break;
+			   case llvm::CmpInst::ICMP_SGE: op = IR_Sge; break;
+			   case llvm::CmpInst::ICMP_ULT: op = IR_Ult; break;
+			   case llvm::CmpInst::ICMP_ULE: op = IR_Ule; break;
+			   case llvm::CmpInst::ICMP_UGT: op = IR_Ugt; break;
+			   default: op = IR_Uge; break;
+		   }
+		   emit(op, dst, slot(cmp->getOperand(0)), slot(cmp->getOperand(1)), 0, width(cmp->getOperand(0)->getType()));
+	   } else if (auto cast = llvm::dyn_cast<llvm::CastInst>(&inst)) {
+		   int32_t src = slot(cast->getOperand(0));
+		   if (cast->getOpcode() == llvm::Instruction::ZExt)
+			   emit(IR_ZExt, dst, src, 0, 0, width(cast->getSrcTy()));
+		   else if (cast->getOpcode() == llvm::Instruction::SExt)
+			   emit(IR_Mov, dst, src);
+		   else
+			   emit(IR_Trunc, dst, src, 0, 0, width(cast->getDestTy()));
+	   } else if (auto select = llvm::dyn_cast<llvm::SelectInst>(&inst)) {
+		   emit(IR_Select, dst, slot(select->getCondition()), slot(select->getTrueValue()), slot(select->getFalseValue()));
+	   } else if (auto load = llvm::dyn_cast<llvm::LoadInst>(&inst)) {
+		   IrOpcode ops[] = { IR_Load8, IR_Load16, IR_Load32, IR_Load64 };
+		   emit(ops[sizeIndex(load->getType())], dst, slot(load->getPointerOperand()));
+	   } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(&inst)) {
+		   IrOpcode ops[] = { IR_Store8, IR_Store16, IR_Store32, IR_Store64 };
+		   emit(ops[sizeIndex(store->getValueOperand()->getType())], slot(store->getPointerOperand()),
+				   slot(store->getValueOperand()));
+	   } else if (auto gep = llvm::dyn_cast<llvm::GetElementPtrInst>(&inst)) {
+		   decodeGep(gep, dst);
+	   } else if (auto alloca = llvm::dyn_cast<llvm::AllocaInst>(&inst)) {
+		   if (!alloca->isStaticAlloca()) {
+			   llvm::errs() << "can not process a variable length array\n";
+			   exit(0);
+		   }
+		   uint64_t size = mLayout.getTypeAllocSize(alloca->getAllocatedType());
+		   size *= llvm::cast<llvm::ConstantInt>(alloca->getArraySize())->getZExtValue();
+		   emit(IR_Alloca, dst, 0, 0, size);
+	   } else if (llvm::isa<llvm::PHINode>(&inst)) {
+		   /// Filled by the moves on the incoming edges
+	   } else if (auto br = llvm::dyn_cast<llvm::BranchInst>(&inst)) {
+		   if (br->isConditional()) {
+			   unsigned pc = emit(IR_CondBr, slot(br->getCondition()));
+			   Edge taken = { pc, true, br->getParent(), br->getSuccessor(0) };
+			   Edge notTaken = { pc, false, br->getParent(), br->getSuccessor(1) };
+			   mEdges.push_back(taken);
+			   mEdges.push_back(notTaken);
+		   } else {
+			   Edge edge = { emit(IR_Br), true, br->getParent(), br->getSuccessor(0) };
+			   mEdges.push_back(edge);
+		   }
+	   } else if (auto ret = llvm::dyn_cast<llvm::ReturnInst>(&inst)) {
+		   if (ret->getReturnValue())
+			   emit(IR_Ret, slot(ret->getReturnValue()));
+		   else
+			   emit(IR_RetVoid);
+	   } else if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+		   decodeCall(call, dst);
+	   } else if (llvm::isa<llvm::UnreachableInst>(&inst)) {
+		   emit(IR_Unreachable);
+	   } else {
+		   llvm::errs() << "can not process the instruction " << inst.getOpcodeName() << "\n";
+		   exit(0);
+	   }
+   }
+
+   unsigned sizeIndex(llvm::Type * type) {
+	   switch (mLayout.getTypeStoreSize(type)) {
+		   case 1: return 0;
+		   case 2: return 1;
+		   case 4: return 2;
+		   case 8: return 3;
+	   }
+	   llvm::errs() << "can not load or store this type\n";
+	   exit(0);
+   }
+
+   /// Constant indexes fold into one offset, every variable one is scaled
+   /// by the size of what it indexes
+   void decodeGep(llvm::GetElementPtrInst * gep, int32_t dst) {
+	   int64_t offset = 0;
+	   std::vector<std::pair<int32_t, int64_t>> scaled;
+	   for (auto it = llvm::gep_type_begin(gep), end = llvm::gep_type_end(gep); it != end; ++it) {
+		   llvm::Value * idx = it.getOperand();
+		   if (llvm::StructType * stype = it.getStructTypeOrNull()) {
+			   unsigned field = llvm::cast<llvm::ConstantInt>(idx)->getZExtValue();
+			   offset += mLayout.getStructLayout(stype)->getElementOffset(field);
+			   continue;
+		   }
+		   int64_t size = mLayout.getTypeAllocSize(it.getIndexedType());
+		   if (auto ci = llvm::dyn_cast<llvm::ConstantInt>(idx))
+			   offset += ci->getSExtValue() * size;
+		   else
+			   scaled.push_back(std::make_pair(slot(idx), size));
+	   }
+	   emit(IR_Gep, dst, slot(gep->getPointerOperand()), 0, offset);
+	   for (auto & index : scaled)
+		   emit(IR_GepIdx, dst, 0, index.first, index.second);
+   }
+
+   void decodeCall(llvm::CallInst * call, int32_t dst) {
+	   const llvm::Function * callee = llvm::dyn_cast<llvm::Function>(call->getCalledValue()->stripPointerCasts());
+	   if (!callee) {
+		   llvm::errs() << "can not process an indirect call\n";
+		   exit(0);
+	   }
+	   if (auto intrinsic = llvm::dyn_cast<llvm::IntrinsicInst>(call)) {
+		   switch (intrinsic->getIntrinsicID()) {
+			   case llvm::Intrinsic::memset:
+				   emit(IR_Memset, slot(call->getArgOperand(0)), slot(call->getArgOperand(1)), slot(call->getArgOperand(2)));
+				   return;
+			   case llvm::Intrinsic::memcpy:
+			   case llvm::Intrinsic::memmove:
+				   emit(IR_Memcpy, slot(call->getArgOperand(0)), slot(call->getArgOperand(1)), slot(call->getArgOperand(2)));
+				   return;
+			   case llvm::Intrinsic::lifetime_start:
+			   case llvm::Intrinsic::lifetime_end:
+			   case llvm::Intrinsic::dbg_declare:
+			   case llvm::Intrinsic::dbg_value:
+				   return;
+			   default:
+				   llvm::errs() << "can not process the intrinsic " << callee->getName() << "\n";
+				   exit(0);
+		   }
+	   }
+	   if (callee->isDeclaration()) {
+		   llvm::StringRef name = callee->getName();
+		   if (name == "GET")
+			   emit(IR_Get, dst, 0, 0, 0, width(call->getType()));
+		   else if (name == "PRINT")
+			   emit(IR_Print, slot(call->getArgOperand(0)));
+		   else if (name == "MALLOC")
+			   emit(IR_Malloc, dst, slot(call->getArgOperand(0)));
+		   else if (name == "FREE")
+			   emit(IR_Free, slot(call->getArgOperand(0)));
+		   else {
+			   llvm::errs() << "can not find the body of " << name << "\n";
+			   exit(0);
+		   }
+		   return;
+	   }
+	   int32_t args = mArgs.size();
+	   for (unsigned i = 0; i < call->getNumArgOperands(); i++)
+		   mArgs.push_back(slot(call->getArgOperand(i)));
+	   emit(IR_Call, dst, mFunctionIndex[callee], args, call->getNumArgOperands());
+   }
+
+   void enter(const IrFunction * fn, int64_t * regs, int64_t * regsEnd) {
+	   if (regs + fn->numSlots > regsEnd) {
+		   llvm::errs() << "stack overflow\n";
+		   exit(0);
+	   }
+	   memcpy(regs + fn->constBase, fn->consts.data(), fn->consts.size() * sizeof(int64_t));
+   }
+
+   static int64_t sext(int64_t val, unsigned shift) {
+	   return (int64_t)((uint64_t)val << shift) >> shift;
+   }
+   static uint64_t zext(int64_t val, unsigned shift) {
+	   return ((uint64_t)val << shift) >> shift;
+   }
+   static void divZero() {
+	   llvm::errs() << "div 0 errs\n";
+	   exit(0);
+   }
+
+   int64_t execute(const IrFunction * fn) {
+	   int64_t * regs = (int64_t *)mRegs.base();
+	   int64_t * regsEnd = regs + mRegs.size() / sizeof(int64_t);
+	   enter(fn, regs, regsEnd);
+	   const IrInstr * code = fn->code.data();
+	   const IrInstr * pc = code;
+
+	   for (;;) {
+		   const IrInstr & i = *pc++;
+		   switch (i.op) {
+			   case IR_Mov: regs[i.a] = regs[i.b]; break;
+			   case IR_Add: regs[i.a] = sext(regs[i.b] + regs[i.c], i.shift); break;
+			   case IR_Sub: regs[i.a] = sext(regs[i.b] - regs[i.c], i.shift); break;
+			   case IR_Mul: regs[i.a] = sext((uint64_t)regs[i.b] * (uint64_t)regs[i.c], i.shift); break;
+			   case IR_SDiv:
+				   if (regs[i.c] == 0)
+					   divZero();
+				   regs[i.a] = sext(regs[i.b] / regs[i.c], i.shift);
+				   break;
+			   case IR_SRem:
+				   if (regs[i.c] == 0)
+					   divZero();
+				   regs[i.a] = sext(regs[i.b] % regs[i.c], i.shift);
+				   break;
+			   case IR_UDiv:
+				   if (zext(regs[i.c], i.shift) == 0)
+					   divZero();
+				   regs[i.a] = sext(zext(regs[i.b], i.shift) / zext(regs[i.c], i.shift), i.shift);
+				   break;
+			   case IR_URem:
+				   if (zext(regs[i.c], i.shift) == 0)
+					   divZero();
+				   regs[i.a] = sext(zext(regs[i.b], i.shift) % zext(regs[i.c], i.shift), i.shift);
+				   break;
+			   case IR_Shl: regs[i.a] = sext((uint64_t)regs[i.b] << (regs[i.c] & 63), i.shift); break;
+			   case IR_LShr: regs[i.a] = sext(zext(regs[i.b], i.shift) >> (regs[i.c] & 63), i.shift); break;
+			   case IR_AShr: regs[i.a] = regs[i.b] >> (regs[i.c] & 63); break;
+			   case IR_And: regs[i.a] = regs[i.b] & regs[i.c]; break;
+			   case IR_Or: regs[i.a] = regs[i.b] | regs[i.c]; break;
+			   case IR_Xor: regs[i.a] = regs[i.b] ^ regs[i.c]; break;
+			   /// An i1 is sign-extended too: true is -1
+			   case IR_Eq: regs[i.a] = -(int64_t)(regs[i.b] == regs[i.c]); break;
+			   case IR_Ne: regs[i.a] = -(int64_t)(regs[i.b] != regs[i.c]); break;
+			   case IR_Slt: regs[i.a] = -(int64_t)(regs[i.b] < regs[i.c]); break;
+			   case IR_Sle: regs[i.a] = -(int64_t)(regs[i.b] <= regs[i.c]); break;
+			   case IR_Sgt: regs[i.a] = -(int64_t)(regs[i.b] > regs[i.c]); break;
+			   case IR_Sge: regs[i.a] = -(int64_t)(regs[i.b] >= regs[i.c]); break;
+			   case IR_Ult: regs[i.a] = -(int64_t)(zext(regs[i.b], i.shift) < zext(regs[i.c], i.shift)); break;
+			   case IR_Ule: regs[i.a] = -(int64_t)(zext(regs[i.b], i.shift) <= zext(regs[i.c], i.shift)); break;
+			   case IR_Ugt: regs[i.a] = -(int64_t)(zext(regs[i.b], i.shift) > zext(regs[i.c], i.shift)); break;
+			   case IR_Uge: regs[i.a] = -(int64_t)(zext(regs[i.b], i.shift) >= zext(regs[i.c], i.shift)); break;
+			   case IR_Trunc: regs[i.a] = sext(regs[i.b], i.shift); break;
+			   case IR_ZExt: regs[i.a] = zext(regs[i.b], i.shift); break;
+			   case IR_Select: regs[i.a] = regs[i.b] ? regs[i.c] : regs[i.imm]; break;
+			   case IR_Load8: regs[i.a] = *(int8_t *)regs[i.b]; break;
+			   case IR_Load16: regs[i.a] = *(int16_t *)regs[i.b]; break;
+			   case IR_Load32: regs[i.a] = *(int32_t *)regs[i.b]; break;
+			   case IR_Load64: regs[i.a] = *(int64_t *)regs[i.b]; break;
+			   case IR_Store8: *(int8_t *)regs[i.a] = regs[i.b]; break;
+			   case IR_Store16: *(int16_t *)regs[i.a] = regs[i.b]; break;
+			   case IR_Store32: *(int32_t *)regs[i.a] = regs[i.b]; break;
+			   case IR_Store64: *(int64_t *)regs[i.a] = regs[i.b]; break;
+			   case IR_Gep: regs[i.a] = regs[i.b] + i.imm; break;
+			   case IR_GepIdx: regs[i.a] += regs[i.c] * i.imm; break;
+			   case IR_Alloca: regs[i.a] = mRegion.allocate(i.imm); break;
+			   case IR_Memset: memset((void *)regs[i.a], (int)regs[i.b], regs[i.c]); break;
+			   case IR_Memcpy: memmove((void *)regs[i.a], (void *)regs[i.b], regs[i.c]); break;
+			   case IR_Br: pc = code + i.imm; break;
+			   case IR_CondBr: pc = code + (regs[i.a] ? i.b : i.c); break;
+			   case IR_Call: {
+				   const IrFunction * callee = &mFunctions[i.b];
+				   int64_t * base = regs + fn->numSlots;
+				   enter(callee, base, regsEnd);
+				   for (int64_t arg = 0; arg < i.imm; arg++)
+					   base[arg] = regs[mArgs[i.c + arg]];
+				   Frame frame = { fn, pc, regs, i.a, mRegion.mark() };
+				   mFrames.push_back(frame);
+				   fn = callee;
+				   code = fn->code.data();
+				   pc = code;
+				   regs = base;
+				   break;
+			   }
+			   case IR_Ret:
+			   case IR_RetVoid: {
+				   int64_t val = i.op == IR_Ret ? regs[i.a] : 0;
+				   if (mFrames.empty())
+					   return val;
+				   Frame & frame = mFrames.back();
+				   fn = frame.fn;
+				   code = fn->code.data();
+				   pc = frame.ret;
+				   regs = frame.base;
+				   if (frame.dst >= 0)
+					   regs[frame.dst] = val;
+				   mRegion.release(frame.mark);
+				   mFrames.pop_back();
+				   break;
+			   }
+			   case IR_Get: {
+				   int64_t val = 0;
+				   llvm::errs() << "Please Input an Integer Value : ";
+				   scanf("%ld", &val);
+				   if (i.a >= 0)
+					   regs[i.a] = sext(val, i.shift);
+				   break;
+			   }
+			   case IR_Print: llvm::errs() << regs[i.a] << "\n"; break;
+			   case IR_Malloc: regs[i.a] = mHeap.Malloc(regs[i.b]); break;
+			   case IR_Free: mHeap.Free(regs[i.a]); break;
+			   case IR_Unreachable:
+				   llvm::errs() << "reached unreachable code\n";
+				   exit(0);
+		   }
+	   }
+   }
+};
+
+/// Runs Clang CodeGen on the guest source, then the SsaInterpreter on the
+/// module once mem2reg has promoted the locals to SSA values
+class SsaAction : public clang::EmitLLVMOnlyAction {
+   size_t mStackBudget;
+public:
+   explicit SsaAction(size_t stackBudget) : mStackBudget(stackBudget) {
+   }
+protected:
+   void EndSourceFileAction() override {
+	   clang::EmitLLVMOnlyAction::EndSourceFileAction();
+	   std::unique_ptr<llvm::Module> module = takeModule();
+	   if (!module)
+		   return;
+	   SsaInterpreter::promote(*module);
+	   SsaInterpreter interpreter(*module, mStackBudget);
+	   interpreter.run();
+   }
+};
+
+#endif
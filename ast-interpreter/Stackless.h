@@ -0,0 +1,305 @@
+//==--- Stackless.h - AST interpreter driven by a continuation stack -------===//
+//===----------------------------------------------------------------------===//
+#ifndef _STACKLESS_H_
+#define _STACKLESS_H_
+
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+
+#include "Environment.h"
+
+using namespace clang;
+
+/// Runs the same Environment handlers as InterpreterVisitor, but keeps what
+/// is left to do on an explicit stack of tasks in heap memory instead of on
+/// the host stack. A guest call pushes the callee body and a CallDone task,
+/// so guest recursion is bounded by the stack budget, not by the host stack.
+/// return, break and continue jump by cutting the task stack back to the
+/// CallDone task or to the head of the innermost loop.
+class StacklessInterpreter {
+   enum Kind : uint8_t {
+	   K_Exec,		/// run the statement
+	   K_Eval,		/// evaluate the expression, leaving one operand
+	   K_Apply,		/// the operands of the expression are ready, apply it
+	   K_Drop,		/// drop the value of an expression statement
+	   K_Decl,		/// bind the VarDecl, its initializer is on the operand stack
+	   K_Release,		/// the block is done, release the stack region to aux
+	   K_If,		/// the condition of the IfStmt is on the operand stack
+	   K_WhileHead,		/// test the condition of the WhileStmt
+	   K_While,		/// the condition of the WhileStmt is on the operand stack
+	   K_ForHead,		/// test the condition of the ForStmt
+	   K_ForCond,		/// the condition of the ForStmt is on the operand stack
+	   K_ForInc,		/// the body of the ForStmt is done, run its increment
+	   K_Return,		/// the value of the ReturnStmt, if any, is on the operand stack
+	   K_Break,		/// leave the innermost loop
+	   K_Continue,		/// start the next iteration of the innermost loop
+	   K_CallDone,		/// the callee body is done, pop its frame
+   };
+   struct Task {
+	   Kind kind;
+	   const void * node;
+	   size_t aux;
+   };
+
+   Environment * mEnv;
+   std::vector<Task> mTasks;
+   size_t mMaxTasks;
+public:
+   StacklessInterpreter(Environment * env, size_t stackBudget)
+   : mEnv(env), mTasks(), mMaxTasks(stackBudget / sizeof(Task)) {
+   }
+
+   void run(FunctionDecl * entry) {
+	   push(K_Exec, entry->getBody());
+	   while (!mTasks.empty()) {
+		   Task task = mTasks.back();
+		   mTasks.pop_back();
+		   step(task);
+	   }
+   }
+
+private:
+   void push(Kind kind, const void * node, size_t aux = 0) {
+	   if (mTasks.size() == mMaxTasks) {
+		   llvm::errs() << "stack overflow\n";
+		   exit(0);
+	   }
+	   Task task = { kind, node, aux };
+	   mTasks.push_back(task);
+   }
+   bool popCondition() {
+	   return mEnv->popOperand() != 0;
+   }
+
+   void step(const Task & task) {
+	   switch (task.kind) {
+		   case K_Exec:
+			   exec((Stmt *)task.node);
+			   break;
+		   case K_Eval:
+			   eval((Expr *)task.node);
+			   break;
+		   case K_Apply:
+			   apply((Expr *)task.node);
+			   break;
+		   case K_Drop:
+			   mEnv->popOperand();
+			   break;
+		   case K_Decl:
+			   mEnv->decl((VarDecl *)task.node);
+			   break;
+		   case K_Release:
+			   mEnv->getStackRegion().release(task.aux);
+			   break;
+		   case K_If: {
+			   IfStmt * ifstmt = (IfStmt *)task.node;
+			   if (popCondition())
+				   push(K_Exec, ifstmt->getThen());
+			   else if (ifstmt->getElse())
+				   push(K_Exec, ifstmt->getElse());
+			   break;
+		   }
+		   case K_WhileHead: {
+			   WhileStmt * wstmt = (WhileStmt *)task.node;
+			   push(K_While, wstmt);
+			   push(K_Eval, wstmt->getCond());
+			   break;
+		   }
+		   case K_While: {
+			   WhileStmt * wstmt = (WhileStmt *)task.node;
+			   if (popCondition()) {
+				   push(K_WhileHead, wstmt);
+				   push(K_Exec, wstmt->getBody());
+			   }
+			   break;
+		   }
+		   case K_ForHead: {
+			   ForStmt * fstmt = (ForStmt *)task.node;
+			   if (fstmt->getCond()) {
+				   push(K_ForCond, fstmt);
+				   push(K_Eval, fstmt->getCond());
+			   } else
+				   iterate(fstmt);
+			   break;
+		   }
+		   case K_ForCond:
+			   if (popCondition())
+				   iterate((ForStmt *)task.node);
+			   break;
+		   case K_ForInc: {
+			   ForStmt * fstmt = (ForStmt *)task.node;
+			   if (fstmt->getInc())
+				   push(K_Exec, fstmt->getInc());
+			   break;
+		   }
+		   case K_Return:
+			   mEnv->rstmt((ReturnStmt *)task.node);
+			   // unwind to the caller; popStack releases the blocks of the frame
+			   while (!mTasks.empty() && mTasks.back().kind != K_CallDone)
+				   mTasks.pop_back();
+			   break;
+		   case K_CallDone: {
+			   int64_t retval = 0;
+			   if (mEnv->getCurrentStack()->hasRetVal())
+				   retval = mEnv->getCurrentStack()->getRetVal();
+			   mEnv->popStack();
+			   mEnv->pushOperand(retval);
+			   break;
+		   }
+		   case K_Break:
+			   // the head task of the loop sits below its body
+			   while (unwind() == K_ForInc)
+				   mTasks.pop_back();
+			   mTasks.pop_back();
+			   break;
+		   case K_Continue:
+			   unwind();
+			   break;
+	   }
+   }
+
+   /// Drop the tasks of the blocks being left, releasing their stack
+   /// region, up to the next task of a loop. Returns its kind.
+   Kind unwind() {
+	   for (;;) {
+		   assert(!mTasks.empty() && mTasks.back().kind != K_CallDone);
+		   Kind kind = mTasks.back().kind;
+		   if (kind == K_ForHead || kind == K_ForInc || kind == K_WhileHead)
+			   return kind;
+		   if (kind == K_Release)
+			   mEnv->getStackRegion().release(mTasks.back().aux);
+		   mTasks.pop_back();
+	   }
+   }
+
+   /// Tasks are popped in reverse order of their pushes
+   void iterate(ForStmt * fstmt) {
+	   push(K_ForHead, fstmt);
+	   push(K_ForInc, fstmt);
+	   push(K_Exec, fstmt->getBody());
+   }
+
+   void exec(Stmt * stmt) {
+	   if (CompoundStmt * cstmt = dyn_cast<CompoundStmt>(stmt)) {
+		   push(K_Release, cstmt, mEnv->getStackRegion().mark());
+		   // statements past one that always leaves the block are never pushed
+		   Stmt ** body = cstmt->body_begin();
+		   for (unsigned i = mEnv->getNodes().lookup(cstmt).live; i > 0; i--)
+			   push(K_Exec, body[i - 1]);
+	   } else if (DeclStmt * declstmt = dyn_cast<DeclStmt>(stmt)) {
+		   for (auto it = declstmt->decl_rbegin(), ie = declstmt->decl_rend(); it != ie; ++it) {
+			   VarDecl * vardecl = dyn_cast<VarDecl>(*it);
+			   if (!vardecl)
+				   continue;
+			   push(K_Decl, vardecl);
+			   if (mEnv->getNodes().lookup(vardecl).init)
+				   push(K_Eval, vardecl->getInit());
+		   }
+	   } else if (IfStmt * ifstmt = dyn_cast<IfStmt>(stmt)) {
+		   push(K_If, ifstmt);
+		   push(K_Eval, ifstmt->getCond());
+	   } else if (WhileStmt * wstmt = dyn_cast<WhileStmt>(stmt)) {
+		   push(K_WhileHead, wstmt);
+	   } else if (ForStmt * fstmt = dyn_cast<ForStmt>(stmt)) {
+		   push(K_ForHead, fstmt);
+		   if (fstmt->getInit())
+			   push(K_Exec, fstmt->getInit());
+	   } else if (ReturnStmt * rstmt = dyn_cast<ReturnStmt>(stmt)) {
+		   push(K_Return, rstmt);
+		   if (rstmt->getRetValue())
+			   push(K_Eval, rstmt->getRetValue());
+	   } else if (isa<BreakStmt>(stmt)) {
+		   push(K_Break, stmt);
+	   } else if (isa<ContinueStmt>(stmt)) {
+		   push(K_Continue, stmt);
+	   } else if (Expr * expr = dyn_cast<Expr>(stmt)) {
+		   push(K_Drop, expr);
+		   push(K_Eval, expr);
+	   } else if (!isa<NullStmt>(stmt)) {
+		   llvm::errs() << "can not process this Stmt\n";
+		   exit(0);
+	   }
+   }
+
+   /// Schedule the evaluated children of expr and then expr itself,
+   /// in the order InterpreterVisitor evaluates them
+   void eval(Expr * expr) {
+	   if (IntegerLiteral * intlt = dyn_cast<IntegerLiteral>(expr)) {
+		   mEnv->intlt(intlt);
+	   } else if (CharacterLiteral * charlt = dyn_cast<CharacterLiteral>(expr)) {
+		   mEnv->chlt(charlt);
+	   } else if (DeclRefExpr * declref = dyn_cast<DeclRefExpr>(expr)) {
+		   mEnv->declref(declref);
+	   } else if (UnaryExprOrTypeTraitExpr * uette = dyn_cast<UnaryExprOrTypeTraitExpr>(expr)) {
+		   mEnv->unaryOrtt(uette);
+	   } else if (ParenExpr * pe = dyn_cast<ParenExpr>(expr)) {
+		   push(K_Eval, pe->getSubExpr());
+	   } else if (CastExpr * castexpr = dyn_cast<CastExpr>(expr)) {
+		   push(K_Eval, castexpr->getSubExpr());
+	   } else if (UnaryOperator * uop = dyn_cast<UnaryOperator>(expr)) {
+		   if (mEnv->folded(mEnv->getNodes().lookup(uop)))
+			   return;
+		   push(K_Apply, uop);
+		   push(K_Eval, uop->getSubExpr());
+	   } else if (ArraySubscriptExpr * ase = dyn_cast<ArraySubscriptExpr>(expr)) {
+		   push(K_Apply, ase);
+		   push(K_Eval, ase->getIdx());
+		   push(K_Eval, ase->getBase());
+	   } else if (BinaryOperator * bop = dyn_cast<BinaryOperator>(expr)) {
+		   if (mEnv->folded(mEnv->getNodes().lookup(bop)))
+			   return;
+		   push(K_Apply, bop);
+		   push(K_Eval, bop->getRHS());
+		   if (!bop->isAssignmentOp()) {
+			   push(K_Eval, bop->getLHS());
+		   } else if (auto ase = dyn_cast<ArraySubscriptExpr>(bop->getLHS())) {
+			   push(K_Eval, ase->getIdx());
+			   push(K_Eval, ase->getBase());
+		   } else if (auto uop = dyn_cast<UnaryOperator>(bop->getLHS())) {
+			   push(K_Eval, uop->getSubExpr());
+		   }
+	   } else if (CallExpr * call = dyn_cast<CallExpr>(expr)) {
+		   push(K_Apply, call);
+		   for (unsigned i = call->getNumArgs(); i > 0; i--)
+			   push(K_Eval, call->getArg(i - 1));
+	   } else {
+		   llvm::errs() << "can not process this Expr\n";
+		   exit(0);
+	   }
+   }
+
+   void apply(Expr * expr) {
+	   if (UnaryOperator * uop = dyn_cast<UnaryOperator>(expr)) {
+		   mEnv->unaryop(uop);
+	   } else if (ArraySubscriptExpr * ase = dyn_cast<ArraySubscriptExpr>(expr)) {
+		   mEnv->arrayse(ase);
+	   } else if (BinaryOperator * bop = dyn_cast<BinaryOperator>(expr)) {
+		   mEnv->binop(bop);
+	   } else if (CallExpr * call = dyn_cast<CallExpr>(expr)) {
+		   const CallTarget & target = mEnv->getCalls().lookup(call);
+		   if (target.tail) {
+			   // the caller only returns what the callee does: its frame
+			   // and its tasks down to its CallDone are replaced, and that
+			   // CallDone pops the frame of the callee instead
+			   while (mTasks.back().kind != K_CallDone)
+				   mTasks.pop_back();
+			   mEnv->popStack();
+			   mEnv->call(call, target);
+			   push(K_Exec, target.body);
+			   return;
+		   }
+		   mEnv->call(call, target);
+		   if (target.inlined) {
+			   push(K_Eval, target.inlined);
+		   } else if (target.kind == Call_User) {
+			   push(K_CallDone, call);
+			   push(K_Exec, target.body);
+		   }
+	   }
+   }
+};
+
+#endif
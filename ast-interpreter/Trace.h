@@ -0,0 +1,428 @@
+//==--- Trace.h - Trace-recording JIT for hot loops -----------------------===//
+//===----------------------------------------------------------------------===//
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+
+#include "Bytecode.h"
+#include "Environment.h"
+#include "Jit.h"
+
+/// What became of a loop handed to the trace tier
+enum LoopOutcome {
+   Loop_Interpret,	/// the tree walker goes on at the head of the loop
+   Loop_Resumed,	/// same, after iterations ran here: values the walker
+			/// derives from the frame are stale
+   Loop_Done,		/// the loop was left
+   Loop_Returned	/// the function returned, its value is in the StackFrame
+};
+
+/// Loop tier of the tree walker. Every WhileStmt/ForStmt head has a counter;
+/// when a loop is hot, one iteration runs on a bytecode interpreter that
+/// records the instructions it executes, with the callees inlined. A
+/// conditional jump becomes a guard on the direction it took. The trace is
+/// compiled with the LLJIT of JitTier and then runs the loop natively,
+/// iteration after iteration, while its guards hold.
+///
+/// A failing guard is a side exit: the native code writes its registers
+/// back and the bytecode interpreter finishes the iteration from the pc the
+/// guard did not expect, rebuilding the frames of the inlined callees. Guest
+/// values are untyped int64 and calls are direct, so branch guards are the
+/// only ones needed.
+///
+/// The variable registers of the bytecode are the FrameLayout slots, so the
+/// frame of the tree walker is copied in and out as the bottom of the
+/// register file.
+class TraceTier {
+   enum Stop {
+	   Stop_Head,
+	   Stop_Left,
+	   Stop_Returned
+   };
+   /// A frame of the bytecode interpreter, registers are absolute indexes
+   struct Frame {
+	   unsigned fn;
+	   unsigned ret;
+	   unsigned base;
+	   unsigned dst;
+	   int64_t mark;
+   };
+   /// Where the bytecode interpreter resumes when a guard fails
+   struct SideExit {
+	   unsigned fn;
+	   unsigned base;
+	   unsigned pc;
+	   /// Inlined callers; their marks are kept in the trace registers
+	   /// from markBase on, one per depth
+	   std::vector<Frame> frames;
+   };
+   typedef int64_t (*TraceEntry)(int64_t * regs);
+   struct Trace {
+	   TraceEntry entry;
+	   std::vector<SideExit> exits;
+	   int32_t markBase;
+   };
+   struct Recording {
+	   std::vector<Instr> code;
+	   std::vector<int64_t> consts;
+	   std::vector<SideExit> exits;
+	   int32_t maxReg;
+	   unsigned maxDepth;
+	   bool aborted;
+   };
+   struct LoopState {
+	   unsigned heat = 0;
+	   unsigned failures = 0;
+	   Trace * trace = NULL;
+   };
+
+   JitTier * mJit;
+   Environment * mEnv;
+   unsigned mThreshold;
+   llvm::DenseMap<const Stmt *, LoopState> mLoops;
+   std::vector<std::unique_ptr<Trace>> mTraces;
+   BcModule * mModule;
+   std::vector<int64_t> mRegs;
+   std::vector<Frame> mFrames;
+   int64_t mResult;
+public:
+   static constexpr unsigned MaxTraceLength = 4096;
+   static constexpr unsigned MaxInlineDepth = 8;
+   /// Recordings aborted before a loop is left to the tree walker for good
+   static constexpr unsigned MaxFailures = 3;
+
+   TraceTier(JitTier * jit, unsigned threshold, size_t numRegs = 1 << 20)
+   : mJit(jit), mEnv(jit->getEnv()), mThreshold(threshold), mLoops(), mTraces(), mModule(NULL),
+	   mRegs(numRegs), mFrames(), mResult(0) {
+   }
+
+   /// Called by the tree walker at the head of every iteration of loop
+   LoopOutcome enter(const Stmt * loop) {
+	   LoopState & state = mLoops[loop];
+	   if (!state.trace && (state.failures >= MaxFailures || ++state.heat < mThreshold))
+		   return Loop_Interpret;
+	   if (!mModule && !(mModule = mJit->getModule())) {
+		   state.failures = MaxFailures;
+		   return Loop_Interpret;
+	   }
+	   assert(mModule->loops.find(loop) != mModule->loops.end());
+	   const BcLoop & range = mModule->loops.find(loop)->second;
+	   StackFrame * frame = mEnv->getCurrentStack();
+	   memcpy(mRegs.data(), frame->getVars(), frame->getNumVars() * sizeof(int64_t));
+	   mFrames.clear();
+
+	   Stop stop;
+	   if (!state.trace) {
+		   Recording rec = { {}, {}, {}, -1, 0, false };
+		   stop = interpret(range, range.function, 0, range.head, &rec);
+		   if (stop == Stop_Head && !rec.aborted)
+			   state.trace = compile(rec);
+		   if (!state.trace) {
+			   state.failures++;
+			   state.heat = 0;
+		   } else if (stop == Stop_Head)
+			   stop = run(range, *state.trace);
+	   } else
+		   stop = run(range, *state.trace);
+
+	   memcpy(frame->getVars(), mRegs.data(), frame->getNumVars() * sizeof(int64_t));
+	   if (stop == Stop_Returned) {
+		   frame->setRetVal(mResult);
+		   return Loop_Returned;
+	   }
+	   return stop == Stop_Left ? Loop_Done : Loop_Resumed;
+   }
+
+private:
+   /// Run the trace until the loop is left, resuming every side exit
+   Stop run(const BcLoop & range, const Trace & trace) {
+	   for (;;) {
+		   const SideExit & exit = trace.exits[trace.entry(mRegs.data())];
+		   mFrames = exit.frames;
+		   for (unsigned depth = 0; depth < mFrames.size(); depth++)
+			   mFrames[depth].mark = mRegs[trace.markBase + depth];
+		   Stop stop = interpret(range, exit.fn, exit.base, exit.pc, NULL);
+		   if (stop != Stop_Head)
+			   return stop;
+	   }
+   }
+
+   void overflow() {
+	   llvm::errs() << "stack overflow\n";
+	   exit(0);
+   }
+
+   /// Interpret the bytecode of fn from pc, its registers starting at base,
+   /// below the frames in mFrames, until the loop function is back at the
+   /// head of range, has left it, or has returned mResult
+   Stop interpret(const BcLoop & range, unsigned fn, unsigned base, unsigned pc, Recording * rec) {
+	   const BcFunction * f = &mModule->functions[fn];
+	   int64_t * regs = mRegs.data() + base;
+	   int64_t * globals = mEnv->getDataSegment().cells();
+	   StackRegion & region = mEnv->getStackRegion();
+	   if (mFrames.empty() && (pc < range.head || pc >= range.end))
+		   return Stop_Left;
+
+	   for (;;) {
+		   const Instr & i = f->code[pc++];
+		   if (rec && !rec->aborted)
+			   record(*rec, i, fn, base, pc);
+		   switch (i.op) {
+			   case BC_LoadK: regs[i.a] = f->consts[i.b]; break;
+			   case BC_Mov: regs[i.a] = regs[i.b]; break;
+			   case BC_LoadG: regs[i.a] = globals[i.b]; break;
+			   case BC_StoreG: globals[i.a] = regs[i.b]; break;
+			   case BC_Add: regs[i.a] = regs[i.b] + regs[i.c]; break;
+			   case BC_Sub: regs[i.a] = regs[i.b] - regs[i.c]; break;
+			   case BC_Mul: regs[i.a] = regs[i.b] * regs[i.c]; break;
+			   case BC_Div:
+				   if (regs[i.c] == 0) {
+					   llvm::errs() << "div 0 errs\n";
+					   exit(0);
+				   }
+				   regs[i.a] = regs[i.b] / regs[i.c];
+				   break;
+			   case BC_LT: regs[i.a] = regs[i.b] < regs[i.c]; break;
+			   case BC_GT: regs[i.a] = regs[i.b] > regs[i.c]; break;
+			   case BC_EQ: regs[i.a] = regs[i.b] == regs[i.c]; break;
+			   case BC_PtrAdd: regs[i.a] = regs[i.b] + 8 * regs[i.c]; break;
+			   case BC_Neg: regs[i.a] = -regs[i.b]; break;
+			   case BC_Load64: regs[i.a] = Heap::load64(regs[i.b]); break;
+			   case BC_Load8: regs[i.a] = Heap::load8(regs[i.b]); break;
+			   case BC_Store64: Heap::store64(regs[i.a], regs[i.b]); break;
+			   case BC_Store8: Heap::store8(regs[i.a], regs[i.b]); break;
+			   case BC_Index64: regs[i.a] = Heap::load64(regs[i.b] + 8 * regs[i.c]); break;
+			   case BC_Index8: regs[i.a] = Heap::load8(regs[i.b] + regs[i.c]); break;
+			   case BC_StIndex64: Heap::store64(regs[i.a] + 8 * regs[i.b], regs[i.c]); break;
+			   case BC_StIndex8: Heap::store8(regs[i.a] + regs[i.b], regs[i.c]); break;
+			   case BC_Alloca: regs[i.a] = region.allocate(f->consts[i.b]); break;
+			   case BC_Mark: regs[i.a] = region.mark(); break;
+			   case BC_Release: region.release(regs[i.a]); break;
+			   case BC_Jmp: pc = i.b; break;
+			   case BC_Jz:
+				   if (!regs[i.a])
+					   pc = i.b;
+				   break;
+			   case BC_Call: {
+				   Frame frame = { fn, pc, base, base + i.a, (int64_t)region.mark() };
+				   mFrames.push_back(frame);
+				   fn = i.b;
+				   f = &mModule->functions[fn];
+				   base += i.c;
+				   regs = mRegs.data() + base;
+				   if (base + f->numRegs > mRegs.size())
+					   overflow();
+				   pc = 0;
+				   break;
+			   }
+			   case BC_Ret:
+			   case BC_RetVoid: {
+				   int64_t val = i.op == BC_Ret ? regs[i.a] : 0;
+				   if (mFrames.empty()) {
+					   mResult = val;
+					   return Stop_Returned;
+				   }
+				   Frame frame = mFrames.back();
+				   mFrames.pop_back();
+				   region.release(frame.mark);
+				   fn = frame.fn;
+				   f = &mModule->functions[fn];
+				   base = frame.base;
+				   regs = mRegs.data() + base;
+				   pc = frame.ret;
+				   mRegs[frame.dst] = val;
+				   break;
+			   }
+			   case BC_Get: regs[i.a] = mEnv->input(); break;
+			   case BC_Print: mEnv->output(regs[i.a]); break;
+			   case BC_Malloc: regs[i.a] = mEnv->allocate(regs[i.b]); break;
+			   case BC_Free: mEnv->deallocate(regs[i.a]); break;
+		   }
+		   // only a jump of the loop function can reach the head or leave it
+		   if (mFrames.empty() && (i.op == BC_Jmp || i.op == BC_Jz)) {
+			   if (pc == range.head)
+				   return Stop_Head;
+			   if (pc < range.head || pc >= range.end)
+				   return Stop_Left;
+		   }
+	   }
+   }
+
+   int32_t reg(Recording & rec, unsigned base, int32_t r) {
+	   int32_t abs = base + r;
+	   rec.maxReg = std::max(rec.maxReg, abs);
+	   return abs;
+   }
+   int32_t constant(Recording & rec, int64_t val) {
+	   for (unsigned idx = 0; idx < rec.consts.size(); idx++)
+		   if (rec.consts[idx] == val)
+			   return idx;
+	   rec.consts.push_back(val);
+	   return rec.consts.size() - 1;
+   }
+   /// Register of the mark saved by the inlined call at depth, numbered
+   /// once the recording is done
+   static int32_t markReg(unsigned depth) {
+	   return -(int32_t)depth - 1;
+   }
+
+   /// Append i, about to be executed with its registers at base, to the
+   /// trace with absolute registers; next is the pc following it
+   void record(Recording & rec, const Instr & i, unsigned fn, unsigned base, unsigned next) {
+	   if (rec.code.size() >= MaxTraceLength) {
+		   rec.aborted = true;
+		   return;
+	   }
+	   const BcFunction & f = mModule->functions[fn];
+	   Instr t = i;
+	   switch (i.op) {
+		   case BC_LoadK:
+		   case BC_Alloca:
+			   t.a = reg(rec, base, i.a);
+			   t.b = constant(rec, f.consts[i.b]);
+			   break;
+		   case BC_LoadG:
+			   t.a = reg(rec, base, i.a);
+			   break;
+		   case BC_StoreG:
+			   t.b = reg(rec, base, i.b);
+			   break;
+		   case BC_Mark:
+		   case BC_Release:
+		   case BC_Get:
+		   case BC_Print:
+		   case BC_Free:
+			   t.a = reg(rec, base, i.a);
+			   break;
+		   case BC_Mov:
+		   case BC_Neg:
+		   case BC_Load64:
+		   case BC_Load8:
+		   case BC_Store64:
+		   case BC_Store8:
+		   case BC_Malloc:
+			   t.a = reg(rec, base, i.a);
+			   t.b = reg(rec, base, i.b);
+			   break;
+		   case BC_Jmp:
+			   return;
+		   case BC_Jz: {
+			   bool taken = mRegs[base + i.a] == 0;
+			   SideExit exit = { fn, base, taken ? next : (unsigned)i.b, mFrames };
+			   t.a = reg(rec, base, i.a);
+			   t.b = rec.exits.size();
+			   t.c = taken;
+			   rec.exits.push_back(exit);
+			   break;
+		   }
+		   case BC_Call: {
+			   // the arguments already sit in the window of the callee
+			   unsigned depth = mFrames.size();
+			   if (depth >= MaxInlineDepth) {
+				   rec.aborted = true;
+				   return;
+			   }
+			   rec.maxDepth = std::max(rec.maxDepth, depth + 1);
+			   t.op = BC_Mark;
+			   t.a = markReg(depth);
+			   break;
+		   }
+		   case BC_Ret:
+		   case BC_RetVoid: {
+			   if (mFrames.empty()) {
+				   rec.aborted = true;
+				   return;
+			   }
+			   const Frame & caller = mFrames.back();
+			   if (i.op == BC_Ret) {
+				   t.op = BC_Mov;
+				   t.b = reg(rec, base, i.a);
+			   } else {
+				   t.op = BC_LoadK;
+				   t.b = constant(rec, 0);
+			   }
+			   t.a = reg(rec, 0, caller.dst);
+			   rec.code.push_back(t);
+			   t.op = BC_Release;
+			   t.a = markReg(mFrames.size() - 1);
+			   break;
+		   }
+		   default:
+			   t.a = reg(rec, base, i.a);
+			   t.b = reg(rec, base, i.b);
+			   t.c = reg(rec, base, i.c);
+			   break;
+	   }
+	   rec.code.push_back(t);
+   }
+
+   /// Lower a recording to t<N>(i64 * regs) -> exit index. The trace loads
+   /// the register file, loops over the recorded iteration, and writes the
+   /// registers back on the exit it takes.
+   Trace * compile(Recording & rec) {
+	   using namespace llvm;
+	   int32_t markBase = rec.maxReg + 1;
+	   unsigned numRegs = markBase + rec.maxDepth;
+	   for (Instr & i : rec.code)
+		   if ((i.op == BC_Mark || i.op == BC_Release) && i.a < 0)
+			   i.a = markBase - i.a - 1;
+
+	   std::string name = "t" + std::to_string(mTraces.size());
+	   std::unique_ptr<LLVMContext> context(new LLVMContext());
+	   std::unique_ptr<Module> module(new Module("trace", *context));
+	   Type * i64 = Type::getInt64Ty(*context);
+	   Function * function = Function::Create(FunctionType::get(i64, { i64->getPointerTo() }, false),
+			   Function::ExternalLinkage, name, module.get());
+	   Value * file = &*function->arg_begin();
+	   BcLowering lowering(*module, function, mEnv, numRegs);
+	   IRBuilder<> & b = lowering.b;
+	   for (unsigned r = 0; r < numRegs; r++)
+		   lowering.set(r, b.CreateLoad(i64, b.CreateGEP(i64, file, b.getInt64(r))));
+	   BasicBlock * loop = lowering.block("loop");
+	   b.CreateBr(loop);
+	   b.SetInsertPoint(loop);
+
+	   std::vector<BasicBlock *> exits;
+	   for (unsigned k = 0; k < rec.exits.size(); k++)
+		   exits.push_back(lowering.block("exit" + std::to_string(k)));
+	   for (const Instr & i : rec.code) {
+		   if (i.op == BC_Jz) {
+			   BasicBlock * next = lowering.block("guard");
+			   if (i.c)
+				   b.CreateCondBr(lowering.isZero(i.a), next, exits[i.b]);
+			   else
+				   b.CreateCondBr(lowering.isZero(i.a), exits[i.b], next);
+			   b.SetInsertPoint(next);
+			   continue;
+		   }
+		   bool lowered = lowering.straight(i, rec.consts);
+		   assert(lowered && "control flow left in a trace");
+		   (void)lowered;
+	   }
+	   b.CreateBr(loop);
+	   for (unsigned k = 0; k < exits.size(); k++) {
+		   b.SetInsertPoint(exits[k]);
+		   for (unsigned r = 0; r < numRegs; r++)
+			   b.CreateStore(lowering.get(r), b.CreateGEP(i64, file, b.getInt64(r)));
+		   b.CreateRet(b.getInt64(k));
+	   }
+
+	   void * entry = mJit->add(std::move(module), std::move(context), name);
+	   if (!entry)
+		   return NULL;
+	   Trace * trace = new Trace();
+	   trace->entry = (TraceEntry)entry;
+	   trace->exits = rec.exits;
+	   trace->markBase = markBase;
+	   mTraces.push_back(std::unique_ptr<Trace>(trace));
+	   return trace;
+   }
+};
+
+#endif
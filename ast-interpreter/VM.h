@@ -0,0 +1,124 @@
+//==--- VM.h - Dispatch loop for the register bytecode --------------------===//
+//===----------------------------------------------------------------------===//
+#ifndef _VM_H_
+#define _VM_H_
+
+#include <vector>
+
+#include "Bytecode.h"
+#include "Environment.h"
+
+/// Executes a BcModule. Guest calls push a VM frame instead of recursing on
+/// the host stack; every frame is a window of the contiguous register file.
+class VM {
+   struct Frame {
+	   const BcFunction * fn;
+	   const Instr * ret;
+	   int64_t * base;
+	   int32_t dst;
+	   /// Top of the stack region when the callee was entered
+	   size_t mark;
+   };
+
+   BcModule & mModule;
+   Environment * mEnv;
+   std::vector<int64_t> mRegs;
+   std::vector<Frame> mFrames;
+public:
+   VM(BcModule & module, Environment * env, size_t numRegs = 1 << 20)
+   : mModule(module), mEnv(env), mRegs(numRegs), mFrames() {
+   }
+
+   int64_t run() {
+	   const BcFunction * fn = &mModule.functions[mModule.entry];
+	   const Instr * pc = fn->code.data();
+	   const int64_t * k = fn->consts.data();
+	   int64_t * regs = mRegs.data();
+	   int64_t * regsEnd = mRegs.data() + mRegs.size();
+	   int64_t * globals = mEnv->getDataSegment().cells();
+	   StackRegion & region = mEnv->getStackRegion();
+	   if (regs + fn->numRegs > regsEnd)
+		   overflow();
+
+	   for (;;) {
+		   const Instr & i = *pc++;
+		   switch (i.op) {
+			   case BC_LoadK: regs[i.a] = k[i.b]; break;
+			   case BC_Mov: regs[i.a] = regs[i.b]; break;
+			   case BC_LoadG: regs[i.a] = globals[i.b]; break;
+			   case BC_StoreG: globals[i.a] = regs[i.b]; break;
+			   case BC_Add: regs[i.a] = regs[i.b] + regs[i.c]; break;
+			   case BC_Sub: regs[i.a] = regs[i.b] - regs[i.c]; break;
+			   case BC_Mul: regs[i.a] = regs[i.b] * regs[i.c]; break;
+			   case BC_Div:
+				   if (regs[i.c] == 0) {
+					   llvm::errs() << "div 0 errs\n";
+					   exit(0);
+				   }
+				   regs[i.a] = regs[i.b] / regs[i.c];
+				   break;
+			   case BC_LT: regs[i.a] = regs[i.b] < regs[i.c]; break;
+			   case BC_GT: regs[i.a] = regs[i.b] > regs[i.c]; break;
+			   case BC_EQ: regs[i.a] = regs[i.b] == regs[i.c]; break;
+			   case BC_PtrAdd: regs[i.a] = regs[i.b] + 8 * regs[i.c]; break;
+			   case BC_Neg: regs[i.a] = -regs[i.b]; break;
+			   case BC_Load64: regs[i.a] = Heap::load64(regs[i.b]); break;
+			   case BC_Load8: regs[i.a] = Heap::load8(regs[i.b]); break;
+			   case BC_Store64: Heap::store64(regs[i.a], regs[i.b]); break;
+			   case BC_Store8: Heap::store8(regs[i.a], regs[i.b]); break;
+			   case BC_Index64: regs[i.a] = Heap::load64(regs[i.b] + 8 * regs[i.c]); break;
+			   case BC_Index8: regs[i.a] = Heap::load8(regs[i.b] + regs[i.c]); break;
+			   case BC_StIndex64: Heap::store64(regs[i.a] + 8 * regs[i.b], regs[i.c]); break;
+			   case BC_StIndex8: Heap::store8(regs[i.a] + regs[i.b], regs[i.c]); break;
+			   case BC_Alloca: regs[i.a] = region.allocate(k[i.b]); break;
+			   case BC_Mark: regs[i.a] = region.mark(); break;
+			   case BC_Release: region.release(regs[i.a]); break;
+			   case BC_Jmp: pc = fn->code.data() + i.b; break;
+			   case BC_Jz:
+				   if (!regs[i.a])
+					   pc = fn->code.data() + i.b;
+				   break;
+			   case BC_Call: {
+				   const BcFunction * callee = &mModule.functions[i.b];
+				   int64_t * base = regs + i.c;
+				   if (base + callee->numRegs > regsEnd)
+					   overflow();
+				   Frame frame = { fn, pc, regs, i.a, region.mark() };
+				   mFrames.push_back(frame);
+				   fn = callee;
+				   pc = fn->code.data();
+				   k = fn->consts.data();
+				   regs = base;
+				   break;
+			   }
+			   case BC_Ret:
+			   case BC_RetVoid: {
+				   int64_t val = i.op == BC_Ret ? regs[i.a] : 0;
+				   if (mFrames.empty())
+					   return val;
+				   Frame & frame = mFrames.back();
+				   fn = frame.fn;
+				   pc = frame.ret;
+				   k = fn->consts.data();
+				   regs = frame.base;
+				   regs[frame.dst] = val;
+				   region.release(frame.mark);
+				   mFrames.pop_back();
+				   break;
+			   }
+			   case BC_Get: regs[i.a] = mEnv->input(); break;
+			   case BC_Print: mEnv->output(regs[i.a]); break;
+			   case BC_Malloc: regs[i.a] = mEnv->allocate(regs[i.b]); break;
+			   case BC_Free: mEnv->deallocate(regs[i.a]); break;
+		   }
+	   }
+   }
+
+private:
+   void overflow() {
+	   llvm::errs() << "stack overflow\n";
+	   exit(0);
+   }
+};
+
+#endif
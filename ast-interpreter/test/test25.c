@@ -0,0 +1,40 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int find(int n) {
+   int i;
+   for (i = 0; i < n; i = i + 1) {
+      int a[4];
+      a[0] = i * i;
+      if (a[0] > 20)
+         return i;
+   }
+   return -1;
+}
+
+int main() {
+   int i, sum;
+   sum = 0;
+   i = 0;
+   while (1) {
+      i = i + 1;
+      if (i > 10)
+         break;
+      if (i / 2 * 2 == i)
+         continue;
+      sum = sum + i;
+   }
+   PRINT(sum);
+   for (i = 0; i < 10; i = i + 1) {
+      char buf[8];
+      if (i < 5)
+         continue;
+      buf[0] = i;
+      PRINT(buf[0]);
+      break;
+   }
+   PRINT(find(10));
+   return 0;
+}
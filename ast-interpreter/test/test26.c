@@ -0,0 +1,17 @@
+// engines: stackless
+// expect: 1000000
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int depth(int n) {
+   if (n == 0)
+      return 0;
+   return 1 + depth(n - 1);
+}
+
+int main() {
+   PRINT(depth(1000000));
+   return 0;
+}
@@ -0,0 +1,30 @@
+// expect: 12 12 12
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int sum(char * p, int n) {
+   int s;
+   s = 0;
+   while (n > 0) {
+      s = s + *p;
+      p = p + 1;
+      n = n - 1;
+   }
+   return s;
+}
+
+int twice(char * p, int n) {
+   return sum(p, n) + sum(p, n);
+}
+
+int main() {
+   char buf[64];
+   int i;
+   for (i = 0; i < 64; i = i + 1)
+      buf[i] = i;
+   for (i = 0; i < 3; i = i + 1)
+      PRINT(twice(buf, 4));
+   return 0;
+}
@@ -0,0 +1,41 @@
+// engines: tree tiered jit stackless
+// expect: 10000000 12000000 30 36 0 1
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int sum(int n, int acc) {
+   if (n == 0)
+      return acc;
+   return sum(n - 1, acc + 2);
+}
+
+int isOdd(int n);
+
+int isEven(int n) {
+   if (n == 0)
+      return 1;
+   return isOdd(n - 1);
+}
+
+int isOdd(int n) {
+   if (n == 0)
+      return 0;
+   return isEven(n - 1);
+}
+
+int outer(int n) {
+   int before = n * 10;
+   int r = sum(n, 0);
+   PRINT(before);
+   return r + before;
+}
+
+int main() {
+   PRINT(outer(1000000));
+   PRINT(outer(3));
+   PRINT(isEven(1000001));
+   PRINT(isOdd(1000001));
+   return 0;
+}
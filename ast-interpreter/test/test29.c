@@ -0,0 +1,36 @@
+// expect: 16 12 7 3 2 1 0 5
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+const int N = 3 * 4;
+
+int pick(int x) {
+   if (1 > 2)
+      return 100;
+   return x;
+   PRINT(99);
+}
+
+int main() {
+   int i = 3;
+   PRINT(sizeof(int) * 16 / sizeof(int));
+   PRINT(N);
+   PRINT(pick(7));
+   while (i > 0) {
+      PRINT(i);
+      i = i - 1;
+      continue;
+      PRINT(100);
+   }
+   PRINT(i);
+   for (i = 0; 1; i = i + 1) {
+      if (i == 5) {
+         break;
+         PRINT(100);
+      }
+   }
+   PRINT(i);
+   return 0;
+}
@@ -0,0 +1,30 @@
+// expect: 2 10 3 16 4 36
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int g;
+
+int twice(int x) {
+   return x + x;
+}
+
+int square(int x) {
+   return x * x;
+}
+
+int bump() {
+   g = g + 1;
+   return g;
+}
+
+int main() {
+   PRINT(twice(bump()));
+   PRINT(twice(bump()) + twice(bump()));
+   PRINT(g);
+   PRINT(twice(twice(bump())));
+   PRINT(g);
+   PRINT(square(bump() + 1));
+   return 0;
+}
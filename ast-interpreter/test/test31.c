@@ -0,0 +1,31 @@
+// expect: 0 75 24 12 0 -4 10 -1
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int a[10];
+
+int main() {
+   int b[5];
+   int i;
+   int n = 0;
+   int s = 0;
+   for (i = 9; i > n; i = i - 1)
+      a[i] = i * 3;
+   PRINT(i);
+   for (i = 0; i < 10; i = i + 2)
+      s = s + a[i + 1];
+   PRINT(s);
+   for (i = 8; i > 0 - 1; i = i - 4)
+      PRINT(a[i]);
+   PRINT(i);
+   for (i = 4; i > 0 - 1; i = i - 1)
+      b[i] = i;
+   s = 0;
+   for (i = 4; i > 0 - 1; i = i - 1)
+      s = s + b[i];
+   PRINT(s);
+   PRINT(i);
+   return 0;
+}
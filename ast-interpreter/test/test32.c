@@ -0,0 +1,31 @@
+// expect: 75025 10 15 75025
+// memoized: fib
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int factor;
+
+int fib(int n) {
+   if (n < 2)
+      return n;
+   return fib(n - 1) + fib(n - 2);
+}
+
+// Reads a global, so its result for n changes with factor
+int scaled(int n) {
+   if (n < 0)
+      return 0;
+   return n * factor;
+}
+
+int main() {
+   PRINT(fib(25));
+   factor = 2;
+   PRINT(scaled(5));
+   factor = 3;
+   PRINT(scaled(5));
+   PRINT(fib(25));
+   return 0;
+}
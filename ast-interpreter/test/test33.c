@@ -0,0 +1,35 @@
+// expect: 7 7 56 48 16
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int a[8];
+int b[8];
+char c[16];
+
+int main() {
+   int i;
+   int s = 0;
+   for (i = 0; i < 8; i = i + 1)
+      a[i] = 5;
+   a[0] = 7;
+   // each element is copied on into the next: not a memmove
+   for (i = 0; i < 7; i = i + 1)
+      a[i + 1] = a[i];
+   PRINT(a[4]);
+   PRINT(a[7]);
+   for (i = 0; i < 8; i = i + 1)
+      b[i] = a[i];
+   for (i = 0; i < 8; i = i + 1)
+      s = s + b[i];
+   PRINT(s);
+   for (i = 0; i < 16; i = i + 1)
+      c[i] = 3;
+   s = 0;
+   for (i = 0; i < 16; i = i + 1)
+      s = s + c[i];
+   PRINT(s);
+   PRINT(i);
+   return 0;
+}
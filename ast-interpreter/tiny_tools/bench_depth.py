@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# Time the interpreter on guest programs whose expressions nest deeper and
+# deeper. Every sub-expression is evaluated once, so the time per iteration
+# has to grow linearly with the depth.
+
+import os
+import subprocess
+import sys
+import time
+
+BUILD_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+HEADER = '''extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+'''
+ITERATIONS = 200
+
+# The tree walker alone, without the LLJIT tiers it would tier up to
+FLAGS = {
+    'tree': ['--engine=tree', '--jit-threshold=0', '--trace-threshold=0'],
+}
+
+# i - (i - (i - ... (i - 1)))) mixes both operands of nested binary and unary
+# operators, the shape that used to be re-evaluated at every level. It reads
+# the loop variable, so it is not hoisted out of the loop.
+def nested(depth):
+    expr = '1'
+    for i in range(depth):
+        if i % 2:
+            expr = '(i - {})'.format(expr)
+        else:
+            expr = '-({} + i)'.format(expr)
+    return expr
+
+def program(depth):
+    return HEADER + '''
+int main() {{
+   int i;
+   int r;
+   i = 0;
+   r = 0;
+   while (i < {}) {{
+      r = {};
+      i = i + 1;
+   }}
+   PRINT(r);
+}}
+'''.format(ITERATIONS, nested(depth))
+
+def run(source, engine):
+    start = time.time()
+    subprocess.check_call(['./ast-interpreter'] + FLAGS.get(engine, ['--engine=' + engine]) + [source],
+                          stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return time.time() - start
+
+def main():
+    os.chdir(BUILD_DIR)
+    engines = sys.argv[1:] or ['tree', 'vm']
+    base = {engine: run(program(0), engine) for engine in engines}
+    print('{:>6} '.format('depth') + ' '.join('{:>14}'.format(e + ' s') for e in engines)
+          + ' ' + ' '.join('{:>14}'.format(e + ' us/node') for e in engines))
+    for depth in [8, 16, 32, 64, 128, 256]:
+        times = [run(program(depth), engine) for engine in engines]
+        per_node = [(t - base[e]) * 1e6 / (depth * ITERATIONS) for t, e in zip(times, engines)]
+        print('{:>6} '.format(depth) + ' '.join('{:>14.4f}'.format(t) for t in times)
+              + ' ' + ' '.join('{:>14.4f}'.format(p) for p in per_node))
+
+if __name__ == '__main__':
+    main()
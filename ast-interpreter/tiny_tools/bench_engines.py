@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# Time every guest program of test/ on several engines. The runs are short,
+# so the times are dominated by start-up and warm-up: the baseline engine has
+# to stay close to the tree walker on the small programs and win on the
+# loops.
+
+import glob
+import os
+import subprocess
+import sys
+import time
+
+BUILD_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+# Answers to GET()
+STDIN = b'10\n' * 64
+REPEAT = 5
+
+# The tree walker alone, without the LLJIT tiers it would tier up to
+FLAGS = {
+    'tree': ['--engine=tree', '--jit-threshold=0', '--trace-threshold=0'],
+}
+
+def run(path, engine):
+    with open(path) as f:
+        source = f.read()
+    args = ['./ast-interpreter'] + FLAGS.get(engine, ['--engine=' + engine]) + [source]
+    best = None
+    for _ in range(REPEAT):
+        start = time.time()
+        subprocess.run(args, input=STDIN, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        elapsed = time.time() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+def main():
+    os.chdir(BUILD_DIR)
+    engines = sys.argv[1:] or ['tree', 'closure', 'vm', 'baseline', 'ir']
+    print('{:>12} '.format('program') + ' '.join('{:>12}'.format(e + ' ms') for e in engines))
+    totals = [0.0] * len(engines)
+    for path in sorted(glob.glob('test/*.c')):
+        times = [run(path, engine) for engine in engines]
+        totals = [t + s for t, s in zip(totals, times)]
+        print('{:>12} '.format(os.path.basename(path)) + ' '.join('{:>12.2f}'.format(t * 1e3) for t in times))
+    print('{:>12} '.format('total') + ' '.join('{:>12.2f}'.format(t * 1e3) for t in totals))
+
+if __name__ == '__main__':
+    main()
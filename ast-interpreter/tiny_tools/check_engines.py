@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# Run every guest program of test/ on several engines and compare what it
+# prints with the tree walker without its tiers. A program can pin its
+# output and the engines it runs on with comments of its own:
+#
+#   // expect: 1 2 3        the values PRINT writes, in order
+#   // engines: stackless   only these engines (default: all of ENGINES)
+#   // memoized: fib        the functions --memo reports, with engine memo
+#
+# It also writes a program image with --compile and checks that --run runs
+# it, and rejects it once damaged.
+
+import glob
+import os
+import platform
+import re
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+BUILD_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+# Answers to GET()
+STDIN = b'10\n' * 64
+# Programs compiled by aot go to a cache of this run only
+AOT_CACHE = tempfile.mkdtemp(prefix='check-engines-aot-')
+# What an engine prints when it could not run the program itself
+FALLBACK = 'falling back to the tree walker'
+
+ENGINES = {
+    'tree': ['--engine=tree', '--jit-threshold=0', '--trace-threshold=0'],
+    # the default command line, tiers at their default thresholds
+    'tiered': ['--engine=tree'],
+    # every function and loop hot at once
+    'jit': ['--engine=tree', '--jit-threshold=1', '--trace-threshold=0'],
+    'trace': ['--engine=tree', '--jit-threshold=0', '--trace-threshold=1'],
+    'memo': ['--engine=tree', '--jit-threshold=0', '--trace-threshold=0', '--memo=64'],
+    'stackless': ['--engine=stackless'],
+    'vm': ['--engine=vm'],
+    'closure': ['--engine=closure'],
+    # C semantics: a test must not print what depends on the width of int
+    'ir': ['--engine=ir'],
+    # the first run compiles each program, the second loads it from the cache
+    'aot': ['--engine=aot', '--aot-cache=' + AOT_CACHE],
+    'aot-cached': ['--engine=aot', '--aot-cache=' + AOT_CACHE],
+}
+# The copy-and-patch stencils are x86-64 System V code
+if platform.machine() in ('x86_64', 'AMD64') and sys.platform.startswith('linux'):
+    ENGINES['baseline'] = ['--engine=baseline']
+REFERENCE = 'tree'
+
+def directive(source, name):
+    match = re.search(r'^// {}: (.*)$'.format(name), source, re.MULTILINE)
+    return match.group(1).split() if match else None
+
+def run(args, source=None):
+    result = subprocess.run(['./ast-interpreter'] + args + ([source] if source is not None else []), input=STDIN,
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    if result.returncode < 0:
+        return None, result.stderr.decode()
+    # PRINT writes to stderr, as does the prompt of GET
+    err = result.stderr.decode().replace('Please Input an Integer Value : ', '')
+    return [line for line in err.splitlines() if re.match(r'^-?\d+$', line)], err
+
+def check(path, engines):
+    with open(path) as f:
+        source = f.read()
+    name = os.path.basename(path)
+    wanted = directive(source, 'engines') or engines
+    expected = directive(source, 'expect')
+    memoized = directive(source, 'memoized')
+    failures = 0
+    for engine in [e for e in engines if e in wanted]:
+        values, err = run(ENGINES[engine], source)
+        if expected is None and engine == REFERENCE:
+            expected = values
+        if values is None:
+            print('{}: {} crashed\n{}'.format(name, engine, err))
+            failures += 1
+        elif FALLBACK in err:
+            print('{}: {} did not run it: {}'.format(name, engine, err.strip()))
+            failures += 1
+        elif expected is not None and values != expected:
+            print('{}: {} printed {}, expected {}'.format(name, engine, values, expected))
+            failures += 1
+        elif engine == 'memo' and memoized is not None:
+            reported = re.findall(r'^memo (\w+):', err, re.MULTILINE)
+            if sorted(reported) != sorted(memoized):
+                print('{}: memo reported {}, expected {}'.format(name, reported, memoized))
+                failures += 1
+    return failures
+
+# ImageHeader of ProgramImage.h, and the size of an Instr
+IMAGE_HEADER = struct.Struct('<8sIIIIQQQQ')
+INSTR_SIZE = 16
+IMAGE_SOURCE = '''extern void PRINT(int);
+int twice(int n) { return n + n; }
+int main() { int a = 21; PRINT(twice(a)); return 0; }
+'''
+
+def corrupt(image, offset, value):
+    return image[:offset] + struct.pack('<i', value) + image[offset + 4:]
+
+def check_images():
+    """An image written by --compile runs, a damaged one is rejected
+    before the VM reads anything out of range."""
+    directory = tempfile.mkdtemp(prefix='check-engines-image-')
+    path = os.path.join(directory, 'prog.img')
+    failures = 0
+    try:
+        run(['--compile=' + path], IMAGE_SOURCE)
+        values, err = run(['--run=' + path])
+        if values != ['42']:
+            print('image: printed {}, expected [\'42\']\n{}'.format(values, err))
+            return 1
+        with open(path, 'rb') as f:
+            image = f.read()
+        numInstrs = IMAGE_HEADER.unpack_from(image)[-1]
+        code = len(image) - numInstrs * INSTR_SIZE
+        damaged = {
+            'truncated': image[:-INSTR_SIZE // 2],
+            'register out of range': corrupt(image, code + 4, 1 << 30),
+            'negative operand': corrupt(image, code + 8, -1),
+            'opcode out of range': image[:code] + b'\xff' + image[code + 1:],
+        }
+        for what, data in damaged.items():
+            with open(path, 'wb') as f:
+                f.write(data)
+            values, err = run(['--run=' + path])
+            if values is None:
+                print('image: {} crashed the VM\n{}'.format(what, err))
+                failures += 1
+            elif values or path not in err:
+                print('image: {} was not rejected: printed {}\n{}'.format(what, values, err))
+                failures += 1
+    finally:
+        shutil.rmtree(directory, ignore_errors=True)
+    return failures
+
+def main():
+    os.chdir(BUILD_DIR)
+    engines = sys.argv[1:] or list(ENGINES)
+    if REFERENCE not in engines:
+        engines.insert(0, REFERENCE)
+    failures = sum(check(path, engines) for path in sorted(glob.glob('test/*.c')))
+    failures += check_images()
+    shutil.rmtree(AOT_CACHE, ignore_errors=True)
+    print('{} failure(s)'.format(failures))
+    sys.exit(1 if failures else 0)
+
+if __name__ == '__main__':
+    main()
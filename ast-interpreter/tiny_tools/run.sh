@@ -1,4 +1,4 @@
 #!/usr/bin/env bash
 set -euxo pipefail
 
- ./ast-interpreter "`cat $1`"
+ ./ast-interpreter "${@:2}" "`cat $1`"